@@ -82,8 +82,13 @@ void gimli_module_call_tracers(gimli_proc_t proc)
   gimli_hook_visit("tracer", visit_tracer, proc);
 }
 
+/* printers registered without a list of types; they may want to see
+ * any variable */
+static int any_type_printers = 0;
+
 int gimli_module_register_var_printer(gimli_var_printer_f func, void *arg)
 {
+  any_type_printers++;
   return gimli_hook_register("prettyprinter", (gimli_hook_f)func, arg);
 }
 
@@ -160,7 +165,8 @@ int gimli_module_register_var_printer_for_types(const char *typenames[],
 
   if (!printer_by_type) {
     printer_by_type = gimli_hash_new(free_printer);
-    gimli_module_register_var_printer(filter_printer_type, NULL);
+    gimli_hook_register("prettyprinter",
+        (gimli_hook_f)filter_printer_type, NULL);
   }
   for (i = 0; i < ntypes; i++) {
     gimli_hash_insert(printer_by_type, typenames[i], list);
@@ -169,6 +175,32 @@ int gimli_module_register_var_printer_for_types(const char *typenames[],
   return 1;
 }
 
+static gimli_iter_status_t wants_after_print(struct module_item *mod,
+    void *arg)
+{
+  if (mod->api_version == 2 && mod->ptr.v2->after_print_frame_var) {
+    return GIMLI_ITER_STOP;
+  }
+  return GIMLI_ITER_CONT;
+}
+
+/* Returns non-zero if a module may render a variable of type t itself,
+ * or wants to see it after it has been printed.  When none does, the
+ * printer is free to render runs of such variables in bulk */
+int gimli_module_wants_var(gimli_type_t t)
+{
+  struct printer_type *list;
+
+  if (any_type_printers) {
+    return 1;
+  }
+  if (printer_by_type && t &&
+      gimli_hash_find(printer_by_type, gimli_type_declname(t), (void**)&list)) {
+    return 1;
+  }
+  return gimli_visit_modules(wants_after_print, NULL) != GIMLI_ITER_CONT;
+}
+
 /* vim:ts=2:sw=2:et:
  */
 
@@ -175,7 +175,7 @@ static void find_dwarf_dSYM(gimli_mapped_object_t file)
 
   container = calloc(1, sizeof(*container));
   container->gobject = file;
-  container->objname = strdup(dsym);
+  container->objname = gimli_intern(dsym);
   container->is_exec = 1;
 
   file->aux_elf = container;
@@ -79,6 +79,31 @@ static int deref(gimli_proc_t proc, uint64_t ptr, uint64_t *resp, uint8_t opsize
   return 1;
 }
 
+/* the CFA of the frame described by cur.  DWARF defines the
+ * CFA as the value of the stack pointer in the caller at the call
+ * site, which is what the unwinder produces when stepping out of
+ * this frame.  st.fp doesn't hold that: it is the CFA that was
+ * computed when unwinding into this frame from its callee.  GCC
+ * uses DW_OP_call_frame_cfa as the frame base whenever the DWARF
+ * version allows it, so locals are found relative to this */
+static uint64_t call_frame_cfa(struct gimli_unwind_cursor *cur)
+{
+  /* run the unwinder on a copy, as the cursor must stay put.
+   * That is a whole unwind step, so it is done once per frame */
+  struct gimli_unwind_cursor c;
+
+  if (!cur->have_cfa) {
+    c = *cur;
+    if (gimli_dwarf_unwind_next(&c)) {
+      cur->cfa = (gimli_addr_t)(intptr_t)c.st.fp;
+    } else {
+      cur->cfa = (gimli_addr_t)(intptr_t)cur->st.fp;
+    }
+    cur->have_cfa = 1;
+  }
+  return cur->cfa;
+}
+
 int dw_eval_expr(struct gimli_unwind_cursor *cur, const uint8_t *ops,
   uint64_t oplen,
   uint64_t frame_base, uint64_t *result, uint64_t *prepopulate,
@@ -96,7 +121,7 @@ int dw_eval_expr(struct gimli_unwind_cursor *cur, const uint8_t *ops,
   struct dw_stack_val val, val2;
   int i;
 
-  memset(&e, 0, sizeof(e));
+  /* the stack is only read below its top, so leave it uninitialized */
   e.ops = ops;
   e.end = ops + oplen;
   e.top = -1;
@@ -351,7 +376,7 @@ int dw_eval_expr(struct gimli_unwind_cursor *cur, const uint8_t *ops,
       case DW_OP_call_frame_cfa:
         val.is_signed = 0;
         val.is_stack = 0;
-        val.v.u64 = (uint64_t)(intptr_t)cur->st.fp;
+        val.v.u64 = call_frame_cfa(cur);
         if (!push(&e, &val)) return 0;
         continue;
 
@@ -578,11 +603,128 @@ int dw_eval_expr(struct gimli_unwind_cursor *cur, const uint8_t *ops,
     }
   }
 
+  if (e.top < 0) {
+    /* an empty expression: the object has no location */
+    return 0;
+  }
   if (is_stack) *is_stack = e.stack[e.top].is_stack;
   *result = e.stack[e.top].v.u64;
   if (debug) printf("eval expr: result=%" PRIx64 "\n", *result);
   return 1;
 }
 
+/* decodes a location expression, or returns the decoding made the
+ * last time it was seen */
+struct gimli_dwarf_expr *dw_compile_expr(gimli_mapped_object_t file,
+  const uint8_t *ops, uint64_t oplen)
+{
+  struct gimli_dwarf_expr *expr;
+  const uint8_t *p = ops, *end = ops + oplen;
+  uint32_t u32;
+  uint8_t op;
+
+  if (!file->exprs) {
+    file->exprs = gimli_hash_new_size(NULL, GIMLI_HASH_PTR_KEYS, 0);
+  } else if (gimli_hash_find_ptr(file->exprs, (void*)ops, (void**)&expr)) {
+    return expr;
+  }
+
+  expr = gimli_slab_alloc(&file->exprslab);
+  memset(expr, 0, sizeof(*expr));
+  expr->ops = ops;
+  expr->oplen = oplen;
+  expr->shape = DW_EXPR_GENERIC;
+
+  if (p < end) {
+    op = *p++;
+
+    if (op >= DW_OP_breg0 && op <= DW_OP_breg31) {
+      expr->shape = DW_EXPR_BREG;
+      expr->reg = op - DW_OP_breg0;
+      expr->operand = dw_read_leb128(&p, end);
+    } else if (op >= DW_OP_reg0 && op <= DW_OP_reg31) {
+      expr->shape = DW_EXPR_REG;
+      expr->reg = op - DW_OP_reg0;
+    } else switch (op) {
+      case DW_OP_fbreg:
+        expr->shape = DW_EXPR_FBREG;
+        expr->operand = dw_read_leb128(&p, end);
+        break;
+      case DW_OP_bregx:
+        expr->shape = DW_EXPR_BREG;
+        expr->reg = dw_read_uleb128(&p, end);
+        expr->operand = dw_read_leb128(&p, end);
+        break;
+      case DW_OP_regx:
+        expr->shape = DW_EXPR_REG;
+        expr->reg = dw_read_uleb128(&p, end);
+        break;
+      case DW_OP_addr:
+        if ((size_t)(end - p) < sizeof(void*)) {
+          break;
+        }
+        expr->shape = DW_EXPR_ADDR;
+        if (sizeof(void*) == 4) {
+          memcpy(&u32, p, sizeof(u32));
+          expr->operand = u32;
+        } else {
+          memcpy(&expr->operand, p, sizeof(expr->operand));
+        }
+        p += sizeof(void*);
+        break;
+      case DW_OP_call_frame_cfa:
+        expr->shape = DW_EXPR_CFA;
+        break;
+    }
+    /* anything following the first operation needs the stack */
+    if (p != end) {
+      expr->shape = DW_EXPR_GENERIC;
+    }
+  }
+
+  gimli_hash_insert_ptr(file->exprs, (void*)ops, expr);
+  return expr;
+}
+
+int dw_eval_compiled(struct gimli_unwind_cursor *cur,
+  struct gimli_dwarf_expr *expr, uint64_t frame_base, uint64_t *result,
+  int *is_stack)
+{
+  uint64_t u64;
+
+  switch (expr->shape) {
+    case DW_EXPR_FBREG:
+      *result = frame_base + expr->operand;
+      if (is_stack) *is_stack = 1;
+      return 1;
+
+    case DW_EXPR_BREG:
+      if (!gimli_reg_get(cur, expr->reg, &u64)) return 0;
+      *result = u64 + expr->operand;
+      if (is_stack) *is_stack = 1;
+      return 1;
+
+    case DW_EXPR_REG:
+      if (!gimli_reg_get(cur, expr->reg, &u64)) return 0;
+      *result = u64;
+      if (is_stack) *is_stack = 0;
+      return 1;
+
+    case DW_EXPR_ADDR:
+      *result = expr->operand;
+      if (is_stack) *is_stack = 1;
+      return 1;
+
+    case DW_EXPR_CFA:
+      *result = call_frame_cfa(cur);
+      if (is_stack) *is_stack = 0;
+      return 1;
+
+    default:
+      return dw_eval_expr(cur, expr->ops, expr->oplen, frame_base, result,
+          NULL, is_stack);
+  }
+}
+
 /* vim:ts=2:sw=2:et:
  */
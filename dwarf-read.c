@@ -13,6 +13,35 @@ struct dw_die_arange {
   uint64_t di_offset;
 };
 
+struct dw_die_global {
+  uint64_t addr;
+  uint64_t size;
+  uint64_t die_offset;
+};
+
+/* a location list, parsed once into its address ranges */
+struct dw_loc_range {
+  uint64_t lo, hi;
+  const uint8_t *expr;
+  uint64_t len;
+  /* position in the list, which decides between overlapping ranges */
+  uint32_t seq;
+};
+
+struct dw_loclist {
+  /* sorted by lo, unless the ranges overlap, in which case they are
+   * kept in list order and searched linearly */
+  struct dw_loc_range *ranges;
+  uint32_t nranges;
+  uint8_t overlaps;
+  /* DW_LLE_default_location */
+  const uint8_t *dflt;
+  uint64_t dflt_len;
+  /* the range that answered the previous lookup; the threads of a
+   * process tend to be stopped at the same handful of pcs */
+  struct dw_loc_range *last;
+};
+
 uint64_t dw_read_uleb128(const uint8_t **ptr, const uint8_t *end)
 {
   uint64_t res = 0;
@@ -164,472 +193,870 @@ int dw_read_encptr(gimli_proc_t proc,
   return 1;
 }
 
-static int sort_by_addr(const void *A, const void *B)
+static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
+  uint16_t ver, const uint8_t **datap, const uint8_t *end,
+  uint64_t *vptr, const uint8_t **byteptr,
+  gimli_object_file_t elf);
+static uint64_t read_offset(const uint8_t **datap, int is_64);
+static uint64_t read_addr(const uint8_t **datap, uint8_t addr_size);
+static int get_sect_data(gimli_mapped_object_t f, const char *name,
+  const uint8_t **startptr, const uint8_t **endptr, gimli_object_file_t *elf);
+static int load_arange(struct gimli_object_mapping *m);
+static int search_compare_arange(const void *K, const void *R);
+static struct gimli_dwarf_cu *find_cu(gimli_mapped_object_t f,
+  uint64_t offset);
+static struct gimli_dwarf_cu *load_cu(gimli_mapped_object_t f,
+  uint64_t offset);
+static int gimli_dwarf_die_get_uint64_t_attr(
+  struct gimli_dwarf_die *die, uint64_t attrcode, uint64_t *val);
+
+
+/* Reads a DWARF 5 directory or file name table from a line number
+ * program header.  The DW_LNCT_path of each entry is recorded in names
+ * by index and, if dirs is not NULL, its DW_LNCT_directory_index in
+ * dirs */
+static int read_line_entries(const uint8_t **datap, const uint8_t *end,
+  uint16_t ver, int is_64, uint8_t addr_size, gimli_object_file_t elf,
+  const char **names, uint32_t *dirs, int maxnames)
 {
-  struct gimli_line_info *a = (struct gimli_line_info*)A;
-  struct gimli_line_info *b = (struct gimli_line_info*)B;
+  const uint8_t *data = *datap;
+  uint64_t formats[2 * 16];
+  uint8_t nformats;
+  uint64_t count, i, v;
+  const uint8_t *bytes;
+  int j;
+
+  nformats = *data++;
+  if (nformats > sizeof(formats)/sizeof(formats[0])/2) {
+    printf("DWARF: too many line header entry formats (%d)\n", nformats);
+    return 0;
+  }
+  for (j = 0; j < nformats; j++) {
+    formats[2*j] = dw_read_uleb128(&data, end);
+    formats[(2*j)+1] = dw_read_uleb128(&data, end);
+  }
+
+  count = dw_read_uleb128(&data, end);
+  for (i = 0; i < count && data < end; i++) {
+    for (j = 0; j < nformats; j++) {
+      uint64_t form = get_value(formats[(2*j)+1], addr_size, is_64, ver,
+          &data, end, &v, &bytes, elf);
+
+      if (form == 0) {
+        return 0;
+      }
+      if (i < maxnames && formats[2*j] == DW_LNCT_path &&
+          form == DW_FORM_string) {
+        names[i] = (const char*)bytes;
+      }
+      if (dirs && i < maxnames && formats[2*j] == DW_LNCT_directory_index) {
+        dirs[i] = v;
+      }
+    }
+  }
 
-  return a->addr - b->addr;
+  *datap = data;
+  return 1;
 }
 
-static int search_compare_line(const void *addrp, const void *L)
+typedef void (*dw_line_row_func_t)(void *arg, gimli_addr_t addr,
+  uint64_t file, uint64_t line);
+
+/* Runs the line number program from *datap through the end of the
+ * sequence that starts there, passing each row to func, which may
+ * be NULL.  The address extent of the sequence is returned in lo and
+ * hi; lo is 0 if the sequence has no rows.  *datap is left at the
+ * start of the next sequence */
+static void run_line_sequence(struct gimli_line_program *lp,
+  const uint8_t **datap, dw_line_row_func_t func, void *arg,
+  gimli_addr_t *lo, gimli_addr_t *hi)
 {
-  struct gimli_line_info *line = (struct gimli_line_info*)L;
-  gimli_addr_t pc = *(gimli_addr_t*)addrp;
+  const uint8_t *data = *datap, *end = lp->end, *next;
+  gimli_addr_t address = 0;
+  uint64_t file = 1, line = 1, len;
+  int have_row = 0;
+  uint16_t u16;
+  uint8_t op;
+  int i;
 
-  if (pc < line->addr) {
-    return -1;
-  }
-  if (pc < line->end) {
-    return 0;
+  *lo = 0;
+  *hi = 0;
+
+  while (data < end) {
+    op = *data++;
+
+    if (op == 0) {
+      /* extended */
+      len = dw_read_uleb128(&data, end);
+      next = data + len;
+      if (len == 0 || next > end) {
+        data = end;
+        break;
+      }
+      op = *data++;
+      switch (op) {
+        case DW_LNE_set_address:
+          address = read_addr(&data, len - 1);
+          break;
+        case DW_LNE_end_sequence:
+          *hi = address;
+          *datap = next;
+          return;
+        case DW_LNE_define_file:
+          /* the file takes the next index; the table is only
+           * extended while the program is first scanned */
+          if (!lp->scanned) {
+            const uint8_t *dirp = data + strlen((char*)data) + 1;
+
+            lp->files = realloc(lp->files,
+                (lp->nfiles + 1) * sizeof(*lp->files));
+            lp->file_dirs = realloc(lp->file_dirs,
+                (lp->nfiles + 1) * sizeof(*lp->file_dirs));
+            lp->files[lp->nfiles] = (const char*)data;
+            lp->file_dirs[lp->nfiles++] = dw_read_uleb128(&dirp, next);
+          }
+          break;
+        default:
+          ;
+      }
+      data = next;
+      continue;
+    }
+
+    if (op < lp->opcode_base) {
+      /* standard opcode */
+      switch (op) {
+        case DW_LNS_copy:
+          break;
+        case DW_LNS_advance_pc:
+          address += dw_read_uleb128(&data, end) * lp->min_insn_len;
+          continue;
+        case DW_LNS_advance_line:
+          line += dw_read_leb128(&data, end);
+          continue;
+        case DW_LNS_set_file:
+          file = dw_read_uleb128(&data, end);
+          continue;
+        case DW_LNS_const_add_pc:
+          address += ((255 - lp->opcode_base) / lp->line_range) *
+            lp->min_insn_len;
+          continue;
+        case DW_LNS_fixed_advance_pc:
+          memcpy(&u16, data, sizeof(u16));
+          data += sizeof(u16);
+          address += u16;
+          continue;
+        default:
+          /* the remaining opcodes (set_column, negate_stmt, set_isa
+           * etc.) don't affect the rows we record; skip their
+           * operands */
+          for (i = 0; i < lp->opcode_lengths[op - 1]; i++) {
+            dw_read_uleb128(&data, end);
+          }
+          continue;
+      }
+    } else {
+      /* special opcode */
+      op -= lp->opcode_base;
+      address += (op / lp->line_range) * lp->min_insn_len;
+      line += lp->line_base + (op % lp->line_range);
+    }
+
+    /* append a row */
+    if (!have_row) {
+      have_row = 1;
+      *lo = address;
+    }
+    if (func) {
+      func(arg, address, file, line);
+    }
   }
-  return 1;
+
+  /* truncated sequence */
+  *hi = address;
+  *datap = data;
 }
 
-static int process_line_numbers(gimli_mapped_object_t f);
+struct line_encoder {
+  struct gimli_line_seq *seq;
+  uint32_t nrows;
+  uint32_t rowalloc, syncalloc;
+  gimli_addr_t addr;
+  uint64_t file, line;
+};
 
-/* read dwarf info to determine the source/line information for a given
- * address */
-int gimli_determine_source_line_number(gimli_proc_t proc,
-  gimli_addr_t pc, char *src, int srclen,
-  uint64_t *lineno)
+static void put_uleb128(struct line_encoder *e, uint64_t v)
 {
-  struct gimli_object_mapping *m;
-  gimli_mapped_object_t f;
-  struct gimli_line_info *linfo;
+  do {
+    uint8_t b = v & 0x7f;
 
-  m = gimli_mapping_for_addr(proc, pc);
-  if (!m) {
-    return 0;
+    v >>= 7;
+    if (v) {
+      b |= 0x80;
+    }
+    e->seq->rows[e->seq->rowlen++] = b;
+  } while (v);
+}
+
+static void put_leb128(struct line_encoder *e, int64_t v)
+{
+  int more = 1;
+
+  while (more) {
+    uint8_t b = v & 0x7f;
+
+    v >>= 7;
+    if ((v == 0 && !(b & 0x40)) || (v == -1 && (b & 0x40))) {
+      more = 0;
+    } else {
+      b |= 0x80;
+    }
+    e->seq->rows[e->seq->rowlen++] = b;
   }
-  f = m->objfile;
+}
 
-  if (!f->elf) {
-    /* can happen if the original file has been removed from disk */
-    return 0;
+static void encode_line_row(void *arg, gimli_addr_t addr,
+  uint64_t file, uint64_t line)
+{
+  struct line_encoder *e = arg;
+  struct gimli_line_seq *seq = e->seq;
+  struct gimli_line_sync *sync;
+
+  if (e->nrows && addr < e->addr) {
+    /* addresses only ascend within a well formed sequence */
+    return;
   }
-  if (!f->lines) {
-    process_line_numbers(f);
-    if (!f->lines) {
-      return 0;
+
+  if (e->nrows++ % GIMLI_LINE_SYNC == 0) {
+    if (seq->nsyncs + 1 >= e->syncalloc) {
+      e->syncalloc = e->syncalloc ? e->syncalloc * 2 : 8;
+      seq->syncs = realloc(seq->syncs, e->syncalloc * sizeof(*sync));
+    }
+    sync = &seq->syncs[seq->nsyncs++];
+    sync->addr = addr;
+    sync->line = line;
+    sync->file = file;
+    sync->pos = seq->rowlen;
+  } else {
+    /* three leb128 values of at most 10 bytes each */
+    if (seq->rowlen + 30 >= e->rowalloc) {
+      e->rowalloc = e->rowalloc ? e->rowalloc * 2 : 256;
+      seq->rows = realloc(seq->rows, e->rowalloc);
+    }
+    put_uleb128(e, ((addr - e->addr) << 1) | (file != e->file));
+    put_leb128(e, (int64_t)(line - e->line));
+    if (file != e->file) {
+      put_uleb128(e, file);
     }
   }
 
-#ifdef __MACH__
-  pc -= f->base_addr;
-#else
-  if (!gimli_object_is_executable(f->elf)) {
-    pc -= calc_reloc(f);
+  e->addr = addr;
+  e->file = file;
+  e->line = line;
+}
+
+/* decodes seq if it isn't already and makes it the most recently
+ * used; the least recently used sequence is discarded once more than
+ * GIMLI_LINE_LRU_MAX are held */
+static int load_line_seq(gimli_mapped_object_t f,
+  struct gimli_line_program *lp, struct gimli_line_seq *seq)
+{
+  struct line_encoder e;
+  struct gimli_line_seq *victim;
+  const uint8_t *data;
+  gimli_addr_t lo, hi;
+
+  if (seq->syncs) {
+    TAILQ_REMOVE(&f->line_lru, seq, lru);
+    TAILQ_INSERT_HEAD(&f->line_lru, seq, lru);
+    return 1;
   }
-#endif
 
-  linfo = bsearch(&pc, f->lines, f->linecount, sizeof(*linfo),
-      search_compare_line);
+  memset(&e, 0, sizeof(e));
+  e.seq = seq;
+  data = seq->start;
+  run_line_sequence(lp, &data, encode_line_row, &e, &lo, &hi);
+  if (!seq->syncs) {
+    return 0;
+  }
 
-  if (linfo) {
-    snprintf(src, srclen, "%s", linfo->filename);
-    *lineno = linfo->lineno;
-    return 1;
+  TAILQ_INSERT_HEAD(&f->line_lru, seq, lru);
+  if (++f->line_lru_count > GIMLI_LINE_LRU_MAX) {
+    victim = TAILQ_LAST(&f->line_lru, gimli_line_lru);
+    TAILQ_REMOVE(&f->line_lru, victim, lru);
+    f->line_lru_count--;
+    free(victim->syncs);
+    free(victim->rows);
+    victim->syncs = NULL;
+    victim->rows = NULL;
+    victim->nsyncs = 0;
+    victim->rowlen = 0;
   }
-  return 0;
+  return 1;
 }
 
-
-static int process_line_numbers(gimli_mapped_object_t f)
+/* finds the last row of a decoded sequence at or below pc */
+static int find_line_row(struct gimli_line_seq *seq, gimli_addr_t pc,
+  uint64_t *file, uint64_t *line)
 {
-  struct gimli_section_data *s = NULL;
-  struct {
-    gimli_addr_t address;
-    uint64_t file;
-    uint64_t line;
-    uint64_t column;
-    uint8_t is_stmt; /* recommended breakpoint location */
-    uint8_t basic_block; /* is start of a basic block */
-    uint8_t end_sequence;
-    uint8_t prologue_end;
-    uint8_t epilogue_begin;
-    uint64_t isa;
-  } regs;
+  uint32_t lo = 0, hi = seq->nsyncs, mid;
+  struct gimli_line_sync *sync;
   const uint8_t *data, *end;
-  uint32_t initlen;
-  uint64_t len;
-  int is_64 = 0;
-  uint16_t ver;
-  struct {
-    uint8_t min_insn_len;
-    uint8_t def_is_stmt;
-    int8_t line_base;
-    uint8_t line_range;
-    uint8_t opcode_base;
-  } hdr_1;
-  uint64_t *opcode_lengths = NULL;
-  int i;
-  const char *filenames[1024];
-  uint8_t op;
-  struct gimli_line_info *linfo;
-  int debugline = debug && 0;
+  gimli_addr_t addr;
+  uint64_t v;
 
-  if (f->aux_elf) {
-    s = gimli_get_section_by_name(f->aux_elf, ".debug_line");
-    if (s) {
-      data = s->data;
-    }
-  }
-  if (!s) {
-    s = gimli_get_section_by_name(f->elf, ".debug_line");
-    if (s) {
-      data = s->data;
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (seq->syncs[mid].addr <= pc) {
+      lo = mid;
+    } else {
+      hi = mid;
     }
   }
-  if (!s) {
+  if (!seq->nsyncs || pc < seq->syncs[lo].addr) {
     return 0;
   }
-  if (debugline) fprintf(stderr, "\nGot debug_line info\n");
-
-  end = data + s->size;
-
+  sync = &seq->syncs[lo];
+  addr = sync->addr;
+  *file = sync->file;
+  *line = sync->line;
+
+  data = seq->rows + sync->pos;
+  if (lo + 1 < seq->nsyncs) {
+    end = seq->rows + seq->syncs[lo + 1].pos;
+  } else {
+    end = seq->rows + seq->rowlen;
+  }
   while (data < end) {
-    const uint8_t *cuend;
-    gimli_addr_t prior;
+    v = dw_read_uleb128(&data, end);
+    if (addr + (v >> 1) > pc) {
+      break;
+    }
+    addr += v >> 1;
+    *line += dw_read_leb128(&data, end);
+    if (v & 1) {
+      *file = dw_read_uleb128(&data, end);
+    }
+  }
+  return 1;
+}
+
+static int sort_compare_line_seq(const void *A, const void *B)
+{
+  struct gimli_line_seq *a = (struct gimli_line_seq*)A;
+  struct gimli_line_seq *b = (struct gimli_line_seq*)B;
 
-    memset(&regs, 0, sizeof(regs));
-    regs.file = 1;
-    regs.line = 1;
-    prior = 0;
+  if (a->lo < b->lo) return -1;
+  if (a->lo > b->lo) return 1;
+  return 0;
+}
 
-    /* read the initial length, this tells us which dwarf version and format
-     * we're dealing with */
-    memcpy(&initlen, data, sizeof(initlen));
-    data += sizeof(initlen);
+static struct gimli_line_seq *find_line_seq(struct gimli_line_program *lp,
+  gimli_addr_t pc)
+{
+  uint32_t lo = 0, hi = lp->nseqs, mid;
 
-    if (initlen == 0xffffffff) {
-      /* this is a 64-bit dwarf */
-      is_64 = 1;
-      memcpy(&len, data, sizeof(len));
-      data += sizeof(len);
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (lp->seqs[mid].lo <= pc) {
+      lo = mid;
     } else {
-      len = initlen;
+      hi = mid;
     }
-    cuend = data + len;
+  }
+  if (lp->nseqs && pc >= lp->seqs[lo].lo && pc < lp->seqs[lo].hi) {
+    return &lp->seqs[lo];
+  }
+  return NULL;
+}
 
-    memcpy(&ver, data, sizeof(ver));
-    data += sizeof(ver);
+static void destroy_line_program(void *item)
+{
+  struct gimli_line_program *lp = item;
+  uint32_t i;
 
-    if (debugline) {
-      fprintf(stderr, "initlen is 0x%" PRIx64 " (%d bit) ver=%u\n",
-        len, is_64 ? 64 : 32, ver);
-    }
+  if (!lp) {
+    return;
+  }
+  for (i = 0; i < lp->nseqs; i++) {
+    free(lp->seqs[i].syncs);
+    free(lp->seqs[i].rows);
+  }
+  free(lp->seqs);
+  free(lp->files);
+  free(lp->file_dirs);
+  free(lp->dirs);
+  free(lp);
+}
 
-    if (is_64) {
-      memcpy(&len, data, sizeof(len));
-      data += sizeof(len);
-    } else {
-      memcpy(&initlen, data, sizeof(initlen));
-      data += sizeof(initlen);
-      len = initlen;
-    }
-    memcpy(&hdr_1, data, sizeof(hdr_1));
-    data += sizeof(hdr_1);
-    regs.is_stmt = hdr_1.def_is_stmt;
+/* Parses the header of a line number program and records the address
+ * extent of each of its sequences.  Rows are only decoded, a sequence
+ * at a time, by load_line_seq() */
+static int parse_line_program(struct gimli_line_program *lp,
+  const uint8_t *data, const uint8_t *end, gimli_object_file_t elf)
+{
+  const uint8_t *cuend, *seqstart;
+  const char *filenames[1024], *dirnames[1024];
+  uint32_t filedirs[1024];
+  uint32_t initlen, alloc = 0;
+  uint64_t len;
+  int is_64;
+  uint16_t ver;
+  uint8_t addr_size = sizeof(void*);
+  gimli_addr_t lo, hi;
+  struct gimli_line_seq *seq;
+  int i;
 
-    if (debugline) {
-      fprintf(stderr,
-        "headerlen is %" PRIu64 ", min_insn_len=%u line_base=%d line_range=%u\n"
-        "opcode_base=%u\n",
-        len, hdr_1.min_insn_len, hdr_1.line_base, hdr_1.line_range,
-        hdr_1.opcode_base);
-    }
-    if (opcode_lengths) free(opcode_lengths);
-    opcode_lengths = calloc(hdr_1.opcode_base, sizeof(uint64_t));
-    for (i = 1; i < hdr_1.opcode_base; i++) {
-      opcode_lengths[i-1] = dw_read_uleb128(&data, cuend);
-      if (debugline) {
-        fprintf(stderr, "op len [%d] = %" PRIu64 "\n", i, opcode_lengths[i-1]);
-      }
+  /* read the initial length, this tells us which dwarf version and format
+   * we're dealing with */
+  memcpy(&initlen, data, sizeof(initlen));
+  data += sizeof(initlen);
+  if (initlen == 0xffffffff) {
+    /* this is a 64-bit dwarf */
+    is_64 = 1;
+    memcpy(&len, data, sizeof(len));
+    data += sizeof(len);
+  } else {
+    is_64 = 0;
+    len = initlen;
+  }
+  if (len > end - data) {
+    printf("DWARF: line number program overruns .debug_line\n");
+    return 0;
+  }
+  cuend = data + len;
+
+  memcpy(&ver, data, sizeof(ver));
+  data += sizeof(ver);
+
+  if (ver >= 5) {
+    /* address_size and segment_selector_size */
+    addr_size = *data++;
+    data++;
+  }
+
+  len = read_offset(&data, is_64);
+  /* the line number program starts after the header */
+  lp->start = data + len;
+  lp->end = cuend;
+
+  lp->min_insn_len = *data++;
+  if (ver >= 4) {
+    /* maximum_operations_per_instruction; only used for VLIW */
+    data++;
+  }
+  /* default_is_stmt */
+  data++;
+  lp->line_base = (int8_t)*data++;
+  lp->line_range = *data++;
+  lp->opcode_base = *data++;
+  lp->opcode_lengths = data;
+  data += lp->opcode_base - 1;
+
+  if (lp->line_range == 0 || lp->opcode_base == 0) {
+    printf("DWARF: invalid line number program header\n");
+    return 0;
+  }
+
+  memset(filenames, 0, sizeof(filenames));
+  memset(dirnames, 0, sizeof(dirnames));
+  memset(filedirs, 0, sizeof(filedirs));
+  if (ver >= 5) {
+    /* directories, then files; each is a table described by a list
+     * of (content type, form) pairs.  File 0 is the primary source
+     * and directory 0 the compilation directory */
+    if (!read_line_entries(&data, lp->start, ver, is_64, addr_size,
+          elf, dirnames, NULL, sizeof(dirnames)/sizeof(dirnames[0])) ||
+        !read_line_entries(&data, lp->start, ver, is_64, addr_size,
+          elf, filenames, filedirs,
+          sizeof(filenames)/sizeof(filenames[0]))) {
+      return 0;
     }
-    /* include_directories */
+  } else {
+    /* include_directories; directory 0 is the compilation directory,
+     * which is only known to the CU */
+    i = 1;
     while (*data && data < cuend) {
-      if (debugline) fprintf(stderr, "inc_dir: %s\n", data);
+      if (i < sizeof(dirnames)/sizeof(dirnames[0])) {
+        dirnames[i++] = (char*)data;
+      }
       data += strlen((char*)data) + 1;
     }
     data++;
 
     /* files */
     i = 1;
-    memset(filenames, 0, sizeof(filenames));
     while (*data && data < cuend) {
       if (i >= sizeof(filenames)/sizeof(filenames[0])) {
-        fprintf(stderr, "DWARF: too many files for line number info reader\n");
+        printf("DWARF: too many files for line number info reader\n");
         return 0;
       }
-      if (debugline) fprintf(stderr, "file[%d] = %s\n", i, data);
       filenames[i] = (char*)data;
       data += strlen((char*)data) + 1;
-      /* ignore additional data about the file */
-      dw_read_uleb128(&data, cuend);
+      filedirs[i++] = dw_read_uleb128(&data, cuend);
+      /* ignore the modification time and size */
       dw_read_uleb128(&data, cuend);
       dw_read_uleb128(&data, cuend);
-      i++;
     }
-    data++;
-
-    /* opcodes */
-    while (data < cuend) {
-      memcpy(&op, data, sizeof(op));
-      data += sizeof(op);
-
-      prior = regs.address;
-
-      if (op == 0) {
-        /* extended */
-        const uint8_t *next;
-        initlen = dw_read_uleb128(&data, cuend);
-        memcpy(&op, data, sizeof(op));
-        next = data + initlen;
-        data += sizeof(op);
-        switch (op) {
-          case DW_LNE_set_address:
-            {
-              void *addr;
-              memcpy(&addr, data, sizeof(addr));
-              if (debugline) fprintf(stderr, "set_address %p\n", addr);
-              regs.address = (intptr_t)addr;
-              break;
-            }
-          case DW_LNE_end_sequence:
-            {
-              if (debugline) fprintf(stderr, "end_sequence\n");
-              memset(&regs, 0, sizeof(regs));
-              regs.file = 1;
-              regs.line = 1;
-              break;
-            }
-          case DW_LNE_define_file:
-            {
-              const char *fname = (char*)data;
-              uint64_t fno;
-
-              data += strlen(fname)+1;
-              fno = dw_read_uleb128(&data, cuend);
-              filenames[fno] = fname;
-              if (debugline) fprintf(stderr, "define_files[%" PRIu64 "] = %s\n", fno, fname);
-              break;
-            }
-
-          default:
-//            fprintf(stderr,
-//              "DWARF: line nos.: unhandled extended op=%02x, len=%" PRIu32 "\n",
-//              op, initlen);
-            ;
-        }
-        data = next;
-      } else if (op < hdr_1.opcode_base) {
-        /* standard opcode */
-        switch (op) {
-          case DW_LNS_copy:
-            if (debugline) fprintf(stderr, "copy\n");
-            regs.basic_block = 0;
-            regs.prologue_end = 0;
-            regs.epilogue_begin = 0;
-            break;
-          case DW_LNS_advance_line:
-            {
-              int64_t d = dw_read_leb128(&data, cuend);
-              if (debugline) {
-                fprintf(stderr, "advance_line from %" PRId64 " to %" PRId64 "\n",
-                  regs.line, regs.line + d);
-              }
-              regs.line += d;
-              break;
-            }
-
-          case DW_LNS_advance_pc:
-            {
-              uint64_t u = dw_read_uleb128(&data, cuend);
-              regs.address += u * hdr_1.min_insn_len;
-              if (debugline) {
-                fprintf(stderr, "advance_pc: addr=" PTRFMT "\n", regs.address);
-              }
-              break;
-            }
-          case DW_LNS_set_file:
-          {
-            uint64_t u = dw_read_uleb128(&data, cuend);
-            regs.file = u;
-            if (debugline) fprintf(stderr, "set_file: %" PRIu64 "\n", regs.file);
-            break;
-          }
-          case DW_LNS_set_column:
-          {
-            uint64_t u = dw_read_uleb128(&data, cuend);
-            regs.column = u;
-            if (debugline) fprintf(stderr, "set_column: %" PRIu64 "\n", regs.column);
-            break;
-          }
-          case DW_LNS_negate_stmt:
-            if (debugline) fprintf(stderr, "negate_stmt\n");
-            regs.is_stmt = !regs.is_stmt;
-            break;
-          case DW_LNS_set_basic_block:
-            if (debugline) fprintf(stderr, "set_basic_block\n");
-            regs.basic_block = 1;
-            break;
-          case DW_LNS_const_add_pc:
-            regs.address += ((255 - hdr_1.opcode_base) /
-                            hdr_1.line_range) * hdr_1.min_insn_len;
-            if (debugline) {
-              fprintf(stderr, "const_add_pc: addr=" PTRFMT "\n", regs.address);
-            }
-            break;
-          case DW_LNS_fixed_advance_pc:
-          {
-            uint16_t u;
-            memcpy(&u, data, sizeof(u));
-            data += sizeof(u);
-            regs.address += u;
-            if (debugline) {
-              fprintf(stderr, "fixed_advance_pc: " PTRFMT "\n", regs.address);
-            }
-            break;
-          }
-          case DW_LNS_set_prologue_end:
-            if (debugline) {
-              fprintf(stderr, "set_prologue_end\n");
-            }
-            regs.prologue_end = 1;
-            break;
-          case DW_LNS_set_epilogue_begin:
-            if (debugline) {
-              fprintf(stderr, "set_epilogue_begin\n");
-            }
-            regs.epilogue_begin = 1;
-            break;
-          case DW_LNS_set_isa:
-            regs.isa = dw_read_uleb128(&data, cuend);
-            if (debugline) {
-              fprintf(stderr, "set_isa: 0x%" PRIx64 "\n", regs.isa);
-            }
-            break;
-          default:
-            fprintf(stderr, "DWARF: line nos: unhandled op: %02x\n", op);
-            /* consume unknown/unhandled args */
-            for (i = 0; i < opcode_lengths[i]; i++) {
-              dw_read_uleb128(&data, cuend);
-            }
-        }
-      } else {
-        /* special opcode */
-        op -= hdr_1.opcode_base;
-
-        if (debugline) {
-          fprintf(stderr, "special before: addr = " PTRFMT ", line = %" PRId64 "\n",
-              regs.address, regs.line);
-          fprintf(stderr, "line_base = %d, line_range = %d\n",
-            hdr_1.line_base, hdr_1.line_range);
-        }
-
-        regs.address += (op / hdr_1.line_range) * hdr_1.min_insn_len;
-        regs.line += hdr_1.line_base + (op % hdr_1.line_range);
-        if (debugline) {
-          fprintf(stderr, "special: addr = " PTRFMT ", line = %" PRId64 "\n",
-            regs.address, regs.line);
-        }
-      }
-
+  }
 
-      if (regs.address && filenames[regs.file]) {
-        if (f->linecount + 1 >= f->linealloc) {
-          f->linealloc = f->linealloc ? f->linealloc * 2 : 1024;
-          f->lines = realloc(f->lines, f->linealloc * sizeof(*linfo));
-        }
-        linfo = &f->lines[f->linecount++];
-        linfo->filename = filenames[regs.file];
-        linfo->lineno = regs.line;
-        linfo->addr = (gimli_addr_t)regs.address;
-      }
+  for (i = sizeof(filenames)/sizeof(filenames[0]); i > 0; i--) {
+    if (filenames[i - 1]) {
+      break;
     }
   }
-
-  qsort(f->lines, f->linecount, sizeof(struct gimli_line_info), sort_by_addr);
-//printf("sorting %d lines in %s\n", f->linecount, f->objname);
-
-  free(opcode_lengths);
-
-  /* make a pass to fill in the end member to make it easier to find
-   * an approx match */
-  if (f->linecount) {
-    for (i = 0; i < f->linecount - 1; i++) {
-      f->lines[i].end = f->lines[i+1].addr;
+  lp->nfiles = i;
+  lp->files = malloc((i ? i : 1) * sizeof(*lp->files));
+  memcpy(lp->files, filenames, i * sizeof(*lp->files));
+  lp->file_dirs = malloc((i ? i : 1) * sizeof(*lp->file_dirs));
+  memcpy(lp->file_dirs, filedirs, i * sizeof(*lp->file_dirs));
+
+  for (i = sizeof(dirnames)/sizeof(dirnames[0]); i > 0; i--) {
+    if (dirnames[i - 1]) {
+      break;
+    }
+  }
+  lp->ndirs = i;
+  lp->dirs = malloc((i ? i : 1) * sizeof(*lp->dirs));
+  memcpy(lp->dirs, dirnames, i * sizeof(*lp->dirs));
+
+  /* walk the sequences to learn the range that each covers */
+  data = lp->start;
+  while (data < lp->end) {
+    seqstart = data;
+    run_line_sequence(lp, &data, NULL, NULL, &lo, &hi);
+    if (!lo || hi <= lo) {
+      /* empty, or discarded by the linker */
+      continue;
     }
+    if (lp->nseqs + 1 >= alloc) {
+      alloc = alloc ? alloc * 2 : 16;
+      lp->seqs = realloc(lp->seqs, alloc * sizeof(*seq));
+    }
+    seq = &lp->seqs[lp->nseqs++];
+    memset(seq, 0, sizeof(*seq));
+    seq->lo = lo;
+    seq->hi = hi;
+    seq->start = seqstart;
   }
+  lp->scanned = 1;
 
-  return 0;
+  qsort(lp->seqs, lp->nseqs, sizeof(*seq), sort_compare_line_seq);
+
+  return 1;
 }
 
-static int get_sect_data(gimli_mapped_object_t f, const char *name,
-  const uint8_t **startptr, const uint8_t **endptr, gimli_object_file_t *elf)
+/* returns the line number program at offset in .debug_line */
+static struct gimli_line_program *load_line_program(gimli_mapped_object_t f,
+  uint64_t offset)
 {
-  const uint8_t *data = NULL, *end = NULL;
-  struct gimli_section_data *s;
+  struct gimli_line_program *lp;
+  const uint8_t *data, *end;
+  gimli_object_file_t elf = f->debug_info.elf;
 
-  if (elf && *elf) {
-    s = gimli_get_section_by_name(*elf, name);
-  } else {
-    s = gimli_get_section_by_name(f->elf, name);
-    if (!s || s->size <= sizeof(void*)) {
-      if (f->aux_elf) {
-        s = gimli_get_section_by_name(f->aux_elf, name);
-      } else {
-        s = NULL;
-      }
-    }
+  if (!f->line_progs) {
+    f->line_progs = gimli_hash_new_size(destroy_line_program,
+        GIMLI_HASH_U64_KEYS, 0);
+    TAILQ_INIT(&f->line_lru);
   }
-  if (s) {
-    data = s->data;
-    if (elf) *elf = s->container;
-  } else {
-    data = NULL;
-    if (elf) *elf = NULL;
+  if (gimli_hash_find_u64(f->line_progs, offset, (void**)&lp)) {
+    return lp;
   }
-  if (data == NULL) {
-    return 0;
+
+  lp = NULL;
+  if (get_sect_data(f, ".debug_line", &data, &end, &elf) &&
+      offset < end - data) {
+    lp = calloc(1, sizeof(*lp));
+    if (!parse_line_program(lp, data + offset, end, elf)) {
+      destroy_line_program(lp);
+      lp = NULL;
+    }
   }
-  end = data + s->size;
+  /* failures are remembered too */
+  gimli_hash_insert_u64(f->line_progs, offset, lp);
 
-  *startptr = data;
-  *endptr = end;
-  return 1;
+  return lp;
 }
 
-
-/* given a location list offset, determine the location in question */
-int dw_calc_location(struct gimli_unwind_cursor *cur,
-  uint64_t compilation_unit_base_addr,
-  struct gimli_object_mapping *m, uint64_t offset, uint64_t *res,
-  gimli_object_file_t elf, int *is_stack)
-{
+/* read dwarf info to determine the source/line information for a given
+ * address.  The line number program comes from the CU that covers
+ * the address, and only the sequence containing it is decoded */
+int gimli_determine_source_line_number(gimli_proc_t proc,
+  gimli_addr_t pc, char *src, int srclen,
+  uint64_t *lineno)
+{
+  struct gimli_object_mapping *m;
+  gimli_mapped_object_t f;
+  struct dw_die_arange *arange;
+  struct gimli_dwarf_cu *cu;
+  struct gimli_line_program *lp;
+  struct gimli_line_seq *seq;
+  uint64_t offset, file, line;
+
+  m = gimli_mapping_for_addr(proc, pc);
+  if (!m) {
+    return 0;
+  }
+  f = m->objfile;
+
+  if (!f->elf) {
+    /* can happen if the original file has been removed from disk */
+    return 0;
+  }
+  if (!load_arange(m)) {
+    return 0;
+  }
+
+#ifdef __MACH__
+  pc -= f->base_addr;
+#endif
+
+  arange = bsearch(&pc, f->arange, f->num_arange,
+      sizeof(*arange), search_compare_arange);
+  if (!arange) {
+    return 0;
+  }
+  cu = find_cu(f, arange->di_offset);
+  if (!cu) {
+    cu = load_cu(f, arange->di_offset);
+  }
+  if (!cu || !cu->die ||
+      !gimli_dwarf_die_get_uint64_t_attr(cu->die, DW_AT_stmt_list, &offset)) {
+    return 0;
+  }
+  lp = load_line_program(f, offset);
+  if (!lp) {
+    return 0;
+  }
+
+#ifndef __MACH__
+  if (!gimli_object_is_executable(f->elf)) {
+    pc -= calc_reloc(f);
+  }
+#endif
+
+  seq = find_line_seq(lp, pc);
+  if (!seq || !load_line_seq(f, lp, seq) ||
+      !find_line_row(seq, pc, &file, &line)) {
+    return 0;
+  }
+  if (file >= lp->nfiles || !lp->files[file]) {
+    return 0;
+  }
+
+  snprintf(src, srclen, "%s", lp->files[file]);
+  *lineno = line;
+  return 1;
+}
+
+static int get_sect_data(gimli_mapped_object_t f, const char *name,
+  const uint8_t **startptr, const uint8_t **endptr, gimli_object_file_t *elf)
+{
+  const uint8_t *data = NULL, *end = NULL;
+  struct gimli_section_data *s;
+
+  if (elf && *elf) {
+    s = gimli_get_section_by_name(*elf, name);
+  } else {
+    s = gimli_get_section_by_name(f->elf, name);
+    if (!s || s->size <= sizeof(void*)) {
+      if (f->aux_elf) {
+        s = gimli_get_section_by_name(f->aux_elf, name);
+      } else {
+        s = NULL;
+      }
+    }
+  }
+  if (s) {
+    data = s->data;
+    if (elf) *elf = s->container;
+  } else {
+    data = NULL;
+    if (elf) *elf = NULL;
+  }
+  if (data == NULL) {
+    return 0;
+  }
+  end = data + s->size;
+
+  *startptr = data;
+  *endptr = end;
+  return 1;
+}
+
+
+static void destroy_loclist(void *item)
+{
+  struct dw_loclist *ll = item;
+
+  free(ll->ranges);
+  free(ll);
+}
+
+static void add_loc_range(struct dw_loclist *ll, uint32_t *alloc,
+  uint64_t lo, uint64_t hi, const uint8_t *expr, uint64_t len)
+{
+  struct dw_loc_range *r;
+
+  if (lo >= hi) {
+    /* empty ranges can never match */
+    return;
+  }
+  if (ll->nranges + 1 >= *alloc) {
+    *alloc = *alloc ? *alloc * 2 : 8;
+    ll->ranges = realloc(ll->ranges, *alloc * sizeof(*r));
+  }
+  r = &ll->ranges[ll->nranges];
+  r->lo = lo;
+  r->hi = hi;
+  r->expr = expr;
+  r->len = len;
+  r->seq = ll->nranges++;
+}
+
+static int sort_compare_loc_range(const void *A, const void *B)
+{
+  const struct dw_loc_range *a = A, *b = B;
+
+  if (a->lo != b->lo) {
+    return a->lo < b->lo ? -1 : 1;
+  }
+  return a->seq < b->seq ? -1 : (a->seq > b->seq ? 1 : 0);
+}
+
+static int sort_compare_loc_seq(const void *A, const void *B)
+{
+  const struct dw_loc_range *a = A, *b = B;
+
+  return a->seq < b->seq ? -1 : (a->seq > b->seq ? 1 : 0);
+}
+
+/* sorts the ranges for searching, unless they overlap, in which case
+ * the first in list order wins and they must be walked */
+static void finish_loclist(struct dw_loclist *ll)
+{
+  uint32_t i;
+
+  qsort(ll->ranges, ll->nranges, sizeof(*ll->ranges),
+      sort_compare_loc_range);
+  for (i = 1; i < ll->nranges; i++) {
+    if (ll->ranges[i].lo < ll->ranges[i - 1].hi) {
+      ll->overlaps = 1;
+      qsort(ll->ranges, ll->nranges, sizeof(*ll->ranges),
+          sort_compare_loc_seq);
+      break;
+    }
+  }
+}
+
+/* .debug_loc and .debug_loclists offsets share one table, so the low
+ * bit of the key says which section the offset is in */
+static struct dw_loclist *find_loclist(gimli_mapped_object_t f,
+  uint64_t key)
+{
+  struct dw_loclist *ll;
+
+  if (f->loclists && gimli_hash_find_u64(f->loclists, key, (void**)&ll)) {
+    return ll;
+  }
+  return NULL;
+}
+
+static struct dw_loclist *new_loclist(gimli_mapped_object_t f, uint64_t key)
+{
+  struct dw_loclist *ll;
+
+  if (!f->loclists) {
+    f->loclists = gimli_hash_new_size(destroy_loclist,
+        GIMLI_HASH_U64_KEYS, 0);
+  }
+  ll = calloc(1, sizeof(*ll));
+  gimli_hash_insert_u64(f->loclists, key, ll);
+  return ll;
+}
+
+/* evaluate the location that a parsed list gives for the current pc */
+static int eval_loclist(struct gimli_unwind_cursor *cur,
+  gimli_mapped_object_t f, struct dw_loclist *ll,
+  uint64_t *res, int *is_stack)
+{
+  uint64_t pc = (uint64_t)(intptr_t)cur->st.pc;
+  struct dw_loc_range *r = NULL;
+  uint32_t lo, hi, mid, i;
+
+  if (ll->last && pc >= ll->last->lo && pc < ll->last->hi) {
+    r = ll->last;
+  } else if (ll->overlaps) {
+    for (i = 0; i < ll->nranges; i++) {
+      if (pc >= ll->ranges[i].lo && pc < ll->ranges[i].hi) {
+        r = &ll->ranges[i];
+        break;
+      }
+    }
+  } else {
+    /* find the last range starting at or before pc */
+    lo = 0;
+    hi = ll->nranges;
+    while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (ll->ranges[mid].lo <= pc) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo > 0 && pc < ll->ranges[lo - 1].hi) {
+      r = &ll->ranges[lo - 1];
+    }
+  }
+
+  if (r) {
+    if (!ll->overlaps) {
+      ll->last = r;
+    }
+    return dw_eval_compiled(cur, dw_compile_expr(f, r->expr, r->len),
+        0, res, is_stack);
+  }
+  if (ll->dflt) {
+    return dw_eval_compiled(cur, dw_compile_expr(f, ll->dflt, ll->dflt_len),
+        0, res, is_stack);
+  }
+  return 0;
+}
+
+/* given a location list offset, determine the location in question */
+int dw_calc_location(struct gimli_unwind_cursor *cur,
+  uint64_t compilation_unit_base_addr,
+  struct gimli_object_mapping *m, uint64_t offset, uint64_t *res,
+  gimli_object_file_t elf, int *is_stack)
+{
   const uint8_t *data, *end;
   void *rstart = NULL, *rend = NULL;
   uint16_t len;
   uint64_t off = compilation_unit_base_addr;
+  struct dw_loclist *ll;
+  uint32_t alloc = 0;
+
+  ll = find_loclist(m->objfile, offset << 1);
+  if (ll) {
+    return eval_loclist(cur, m->objfile, ll, res, is_stack);
+  }
 
   if (!get_sect_data(m->objfile, ".debug_loc", &data, &end, &elf)) {
     printf("Couldn't find a .debug_loc\n");
     return 0;
   }
 
-//  printf("Using offset %d into .debug_loc\n", offset);
+  ll = new_loclist(m->objfile, offset << 1);
   data += offset;
 
   while (data < end) {
-//    printf("populating rstart with %d bytes\n", sizeof(rstart));
     memcpy(&rstart, data, sizeof(rstart));
     data += sizeof(rstart);
     memcpy(&rend, data, sizeof(rend));
     data += sizeof(rend);
     if (rstart == 0 && rend == 0) {
       /* end of list */
-//      printf("rstart = %p, so ending list\n", rstart);
       break;
     }
     if (rstart == (void*)-1) {
@@ -644,99 +1071,77 @@ int dw_calc_location(struct gimli_unwind_cursor *cur,
 
     memcpy(&len, data, sizeof(len));
     data += sizeof(len);
-//    printf("This section is %d bytes in length\n", len);
-
-//    printf("%p - %p\n", rstart, rend);
-    if (cur->st.pc >= (intptr_t)rstart && cur->st.pc < (intptr_t)rend) {
-//      printf("Found the range I was looking for, data=%p, len=%d\n", data, len);
 
-      return dw_eval_expr(cur, (uint8_t*)data, len, 0, res, NULL, is_stack);
-    }
+    add_loc_range(ll, &alloc, (uint64_t)(intptr_t)rstart,
+        (uint64_t)(intptr_t)rend, data, len);
     data += len;
   }
-  return 0;
+  finish_loclist(ll);
+
+  return eval_loclist(cur, m->objfile, ll, res, is_stack);
 }
 
 
-static const uint8_t *find_abbr(gimli_mapped_object_t file,
-    uint64_t da_offset,
-    uint64_t fcode)
+static uint64_t read_offset(const uint8_t **datap, int is_64)
 {
-  uint64_t code;
-  uint64_t tag;
-  uint64_t key;
-  const uint8_t *abbr;
-  int slow_mode = 0;
-
-  if (!file->abbr.map) {
-    if (!get_sect_data(file, ".debug_abbrev",
-          &file->abbr.start, &file->abbr.end, &file->abbr.elf)) {
-      printf("could not get abbrev data for %s\n", file->objname);
-      return 0;
-    }
-
-    /* observed approx 11-13 per abbrev, err on the side of avoiding
-     * rebuckets */
-    file->abbr.map = gimli_hash_new_size(NULL, GIMLI_HASH_U64_KEYS,
-        (file->abbr.end - file->abbr.start) / 10);
-  }
+  uint64_t u64;
+  uint32_t u32;
 
-  /* NOTE: even though DWARF allows for 64-bit offsets, we're making the assumption
-   * that they are not practical or possible for the next few years.
-   * Doing so allows us to cheaply record both the da_offset and code
-   * into a u64 key.
-   * I've observed approx 17% collisions with a max chain length of 7
-   * in a collided bucket.  It's not perfect but it is effective.
-   * */
-  if (da_offset > UINT32_MAX || fcode > UINT32_MAX) {
-    // Allow correct, albeit slow, operation when we overflow this assumption
-    slow_mode = 1;
-  }
-  if (!slow_mode) {
-    key = (da_offset << 32) | (fcode & 0xffffffff);
-    if (gimli_hash_find_u64(file->abbr.map, key, (void**)&abbr)) {
-      return abbr;
-    }
+  if (is_64) {
+    memcpy(&u64, *datap, sizeof(u64));
+    *datap += sizeof(u64);
+    return u64;
   }
+  memcpy(&u32, *datap, sizeof(u32));
+  *datap += sizeof(u32);
+  return u32;
+}
 
-  abbr = file->abbr.start + da_offset;
-
-  while (abbr < file->abbr.end) {
-    code = dw_read_uleb128(&abbr, file->abbr.end);
-    if (code == 0) continue;
-//    printf("find_abbr: %lld (looking for %lld)\n", code, fcode);
-    if (fcode == code) {
-
-//printf("find_abbr: %" PRIx64 " -> %p\n", fcode, abbr);
-      if (!slow_mode &&
-          !gimli_hash_insert_u64(file->abbr.map, key, (void*)abbr)) {
-        void *ptr = NULL;
-        gimli_hash_find_u64(file->abbr.map, key, &ptr);
-        if (ptr != abbr) {
-          printf("find_abbr: %" PRIx64 " (key=%" PRIx64 ") collided with %p and %p\n",
-              fcode, key, abbr, ptr);
-        }
-      }
-      return abbr;
-    }
+static uint64_t read_addr(const uint8_t **datap, uint8_t addr_size)
+{
+  uint64_t u64 = 0;
+  uint32_t u32;
+  uint16_t u16;
+  uint8_t u8;
 
-    tag = dw_read_uleb128(&abbr, file->abbr.end);
-    abbr += sizeof(uint8_t);
+  switch (addr_size) {
+    case 1:
+      memcpy(&u8, *datap, sizeof(u8));
+      u64 = u8;
+      break;
+    case 2:
+      memcpy(&u16, *datap, sizeof(u16));
+      u64 = u16;
+      break;
+    case 4:
+      memcpy(&u32, *datap, sizeof(u32));
+      u64 = u32;
+      break;
+    case 8:
+      memcpy(&u64, *datap, sizeof(u64));
+      break;
+  }
+  *datap += addr_size;
+  return u64;
+}
 
+/* resolve an offset into one of the string sections */
+static const uint8_t *get_string(const char *sectname, uint64_t offset,
+  gimli_object_file_t elf)
+{
+  const uint8_t *strp, *send;
 
-    while (abbr < file->abbr.end) {
-      dw_read_uleb128(&abbr, file->abbr.end);
-      code = dw_read_uleb128(&abbr, file->abbr.end);
-      if (code == 0) {
-        break;
-      }
-    }
+  if (!get_sect_data(NULL, sectname, &strp, &send, &elf)) {
+    return NULL;
   }
-  return NULL;
+  if (strp + offset >= send) {
+    return NULL;
+  }
+  return strp + offset;
 }
 
 static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
-  const uint8_t **datap, const uint8_t *end,
+  uint16_t ver, const uint8_t **datap, const uint8_t *end,
   uint64_t *vptr, const uint8_t **byteptr,
   gimli_object_file_t elf)
 {
@@ -746,69 +1151,73 @@ static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
   uint16_t u16;
   uint8_t u8;
   const uint8_t *data = *datap;
-  const uint8_t *strp, *send;
+  const uint8_t *str;
 
   *byteptr = NULL;
 
   switch (form) {
-    case DW_FORM_addr:
     case DW_FORM_ref_addr:
-      switch (addr_size) {
-        case 1:
-          memcpy(&u8, data, sizeof(u8));
-          *vptr = u8;
-          break;
-        case 2:
-          memcpy(&u16, data, sizeof(u16));
-          *vptr = u16;
-          break;
-        case 4:
-          memcpy(&u32, data, sizeof(u32));
-          *vptr = u32;
-          break;
-        case 8:
-          memcpy(vptr, data, sizeof(u64));
-          break;
+      if (ver > 2) {
+        /* only DWARF 2 uses the address size here */
+        *vptr = read_offset(&data, is_64);
+        break;
       }
-      data += addr_size;
+      /* fall through */
+    case DW_FORM_addr:
+      *vptr = read_addr(&data, addr_size);
       break;
     case DW_FORM_data1:
     case DW_FORM_ref1:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
       memcpy(&u8, data, sizeof(u8));
       data += sizeof(u8);
       *vptr = u8;
       break;
     case DW_FORM_data2:
     case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
       memcpy(&u16, data, sizeof(u16));
       data += sizeof(u16);
       *vptr = u16;
       break;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+#if WORDS_BIGENDIAN
+      *vptr = (data[0] << 16) | (data[1] << 8) | data[2];
+#else
+      *vptr = data[0] | (data[1] << 8) | (data[2] << 16);
+#endif
+      data += 3;
+      break;
     case DW_FORM_data4:
     case DW_FORM_ref4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+    case DW_FORM_ref_sup4:
       memcpy(&u32, data, sizeof(u32));
       data += sizeof(u32);
       *vptr = u32;
       break;
     case DW_FORM_data8:
     case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
       memcpy(&u64, data, sizeof(u64));
       data += sizeof(u64);
       *vptr = u64;
       break;
     case DW_FORM_sec_offset:
-      if (is_64) {
-        memcpy(&u64, data, sizeof(u64));
-        data += sizeof(u64);
-        *vptr = u64;
-      } else {
-        memcpy(&u32, data, sizeof(u32));
-        data += sizeof(u32);
-        *vptr = u32;
-      }
+    case DW_FORM_strp_sup:
+      *vptr = read_offset(&data, is_64);
       break;
     case DW_FORM_udata:
     case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
       *vptr = dw_read_uleb128(&data, end);
       break;
     case DW_FORM_sdata:
@@ -823,6 +1232,10 @@ static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
     case DW_FORM_flag_present:
       *vptr = 1;
       break;
+    case DW_FORM_implicit_const:
+      /* the value lives in the abbreviation; see load_die_attrs */
+      *vptr = 0;
+      break;
 
     /* for blocks, store length in vptr and set byteptr to start of data */
     case DW_FORM_block1:
@@ -852,18 +1265,18 @@ static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
       *byteptr = data;
       data += *vptr;
       break;
+    case DW_FORM_data16:
+      *vptr = 16;
+      *byteptr = data;
+      data += 16;
+      break;
 
     case DW_FORM_strp:
-      if (is_64) {
-        memcpy(vptr, data, sizeof(*vptr));
-        data += sizeof(*vptr);
-      } else {
-        memcpy(&u32, data, sizeof(u32));
-        data += sizeof(u32);
-        *vptr = u32;
-      }
-      if (get_sect_data(NULL, ".debug_str", &strp, &send, &elf)) {
-        const uint8_t *str = strp + *vptr;
+    case DW_FORM_line_strp:
+      *vptr = read_offset(&data, is_64);
+      str = get_string(form == DW_FORM_strp ? ".debug_str" : ".debug_line_str",
+          *vptr, elf);
+      if (str) {
         *vptr = strlen((char*)str);
         form = DW_FORM_string;
         *byteptr = str;
@@ -882,7 +1295,8 @@ static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
           "DWARF: can't have an indirect FORM reference an indirect FORM\n");
         return 0;
       }
-      return get_value(form, addr_size, is_64, datap, end, vptr, byteptr, elf);
+      return get_value(form, addr_size, is_64, ver, datap, end,
+          vptr, byteptr, elf);
 
     default:
       printf("DWARF: unhandled FORM: 0x%" PRIx64 "\n", form);
@@ -904,12 +1318,19 @@ static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
     case DW_FORM_block1:
     case DW_FORM_block2:
     case DW_FORM_block4:
+    case DW_FORM_exprloc:
+    case DW_FORM_data16:
       form = DW_FORM_block;
       break;
     case DW_FORM_data1:
     case DW_FORM_data2:
     case DW_FORM_data4:
     case DW_FORM_data8:
+    /* references outside of this object; we can't follow these */
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_ref_sup8:
+    case DW_FORM_strp_sup:
       form = DW_FORM_data8;
       break;
     case DW_FORM_ref1:
@@ -919,6 +1340,20 @@ static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
     case DW_FORM_ref_udata:
       form = DW_FORM_ref_udata;
       break;
+    /* indexed forms are kept as an index; they are resolved against
+     * the CU when the attribute is looked up */
+    case DW_FORM_strx1:
+    case DW_FORM_strx2:
+    case DW_FORM_strx3:
+    case DW_FORM_strx4:
+      form = DW_FORM_strx;
+      break;
+    case DW_FORM_addrx1:
+    case DW_FORM_addrx2:
+    case DW_FORM_addrx3:
+    case DW_FORM_addrx4:
+      form = DW_FORM_addrx;
+      break;
   }
   if (debug && 0) {
     printf("value normalized to form 0x%" PRIx64 " val=0x%" PRIx64 " bytep=%p %s\n",
@@ -929,115 +1364,455 @@ static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
   return form;
 }
 
-static struct gimli_dwarf_die *process_die(
-  gimli_mapped_object_t file,
-  struct gimli_dwarf_cu *cu,
-  const uint8_t *custart,
-  const uint8_t **datap, const uint8_t *end,
-  uint64_t da_offset,
-  int is_64, uint8_t addr_size
-)
+/* The DIE tree is materialized lazily.  load_cu records only the unit
+ * DIE; the immediate children of a DIE are recorded (offset, tag and
+ * where their subtree ends) the first time someone iterates them, and
+ * the attributes of a DIE are decoded the first time one of them is
+ * looked up.  Stepping over subtrees uses DW_AT_sibling where the
+ * producer emitted it and otherwise skips attribute data using sizes
+ * derived from the abbreviation, so that nothing is allocated for the
+ * parts of a CU that are never examined. */
+
+/* returns the encoded size of a form if it doesn't depend on the
+ * value, or -1 if the value must be decoded to find its length */
+static int form_fixed_size(struct gimli_dwarf_cu *cu, uint64_t form)
 {
-  const uint8_t *data = *datap;
-  uint64_t abbr_code;
-  uint64_t tag;
-  uint8_t has_children;
-  uint64_t atype, aform;
-  const uint8_t *abbr;
-  struct gimli_dwarf_die *die = NULL, *kid = NULL;
-  struct gimli_dwarf_attr *attr = NULL;
-  uint64_t offset;
-
-  offset = data - file->debug_info.start;
-
-  abbr_code = dw_read_uleb128(&data, end);
-  if (abbr_code == 0) {
-    // Skip over NUL entry
-//    printf("found a NUL entry @ 0x%" PRIx64 "\n", offset);
-    *datap = data;
-    return NULL;
-  }
-  abbr = find_abbr(file, da_offset, abbr_code);
-  if (!abbr) {
-    printf("Couldn't locate abbrev code %" PRId64 "\n", abbr_code);
-    *datap = data;
-    return NULL;
+  switch (form) {
+    case DW_FORM_flag_present:
+    case DW_FORM_implicit_const:
+      return 0;
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_flag:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+      return 1;
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+      return 2;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+      return 3;
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+    case DW_FORM_ref_sup4:
+      return 4;
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
+      return 8;
+    case DW_FORM_data16:
+      return 16;
+    case DW_FORM_addr:
+      return cu->addr_size;
+    case DW_FORM_ref_addr:
+      if (cu->version <= 2) {
+        return cu->addr_size;
+      }
+      /* fall through */
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+    case DW_FORM_strp_sup:
+    case DW_FORM_sec_offset:
+      return cu->is_64 ? 8 : 4;
+    default:
+      return -1;
   }
+}
 
-  /* what kind of entry is this? */
-  tag = dw_read_uleb128(&abbr, file->abbr.end);
-  memcpy(&has_children, abbr, sizeof(has_children));
-  abbr += sizeof(has_children);
-  if (has_children != 0 && has_children != 1) {
-    printf("invalid value for has_children! %d\n", has_children);
-    abort();
-  }
+static int compare_abbr(const void *A, const void *B)
+{
+  const struct gimli_dwarf_abbr *a = A, *b = B;
 
-  die = gimli_slab_alloc(&file->dieslab);
-  memset(die, 0, sizeof(*die));
-  die->offset = offset;
-  die->tag = tag;
-  STAILQ_INIT(&die->kids);
+  if (a->code < b->code) return -1;
+  if (a->code > b->code) return 1;
+  return 0;
+}
+
+/* Decode the abbreviation table used by cu.  Each table is decoded
+ * once into a sorted array, along with the (attr, form) specs of each
+ * abbreviation and the sizes that follow from them, so that decoding
+ * a DIE doesn't need to parse the abbreviation again */
+static struct gimli_dwarf_abbr_table *load_abbr_table(
+  gimli_mapped_object_t file, struct gimli_dwarf_cu *cu)
+{
+  struct gimli_dwarf_abbr_table *t;
+  struct gimli_dwarf_abbr *ab;
+  struct gimli_dwarf_abbr_attr *spec;
+  const uint8_t *abbr, *end;
+  uint64_t key, code, atype, aform;
+  uint32_t nabbrs = 0, nattrs = 0, i;
+
+  if (!file->abbr.tables) {
+    if (!get_sect_data(file, ".debug_abbrev",
+          &file->abbr.start, &file->abbr.end, &file->abbr.elf)) {
+      printf("could not get abbrev data for %s\n", file->objname);
+      return NULL;
+    }
+    file->abbr.tables = gimli_hash_new_size(free, GIMLI_HASH_U64_KEYS, 0);
+  }
+
+  key = (cu->da_offset << 8) | (cu->addr_size << 2) |
+    (cu->is_64 << 1) | (cu->version <= 2);
+  if (gimli_hash_find_u64(file->abbr.tables, key, (void**)&t)) {
+    return t;
+  }
+
+  /* count the abbreviations and their specs, so that the table can
+   * be held in a single allocation */
+  end = file->abbr.end;
+  abbr = file->abbr.start + cu->da_offset;
+  while (abbr < end) {
+    code = dw_read_uleb128(&abbr, end);
+    if (code == 0) {
+      break;
+    }
+    dw_read_uleb128(&abbr, end);
+    abbr += sizeof(uint8_t);
+    while (abbr < end) {
+      atype = dw_read_uleb128(&abbr, end);
+      aform = dw_read_uleb128(&abbr, end);
+      if (aform == DW_FORM_implicit_const) {
+        dw_read_leb128(&abbr, end);
+      }
+      if (atype == 0) {
+        break;
+      }
+      nattrs++;
+    }
+    nabbrs++;
+  }
+
+  t = calloc(1, sizeof(*t) + (nabbrs * sizeof(*ab)) +
+      (nattrs * sizeof(*spec)));
+  t->abbrs = (struct gimli_dwarf_abbr*)(t + 1);
+  t->nabbrs = nabbrs;
+  spec = (struct gimli_dwarf_abbr_attr*)(t->abbrs + nabbrs);
+
+  abbr = file->abbr.start + cu->da_offset;
+  for (i = 0; i < nabbrs; i++) {
+    ab = &t->abbrs[i];
+    ab->code = dw_read_uleb128(&abbr, end);
+    ab->tag = dw_read_uleb128(&abbr, end);
+    memcpy(&ab->has_children, abbr, sizeof(ab->has_children));
+    abbr += sizeof(ab->has_children);
+    if (ab->has_children != 0 && ab->has_children != 1) {
+      printf("invalid value for has_children! %d\n", ab->has_children);
+      abort();
+    }
+    ab->attrs = spec;
+
+    while (abbr < end) {
+      atype = dw_read_uleb128(&abbr, end);
+      aform = dw_read_uleb128(&abbr, end);
+      if (aform == DW_FORM_implicit_const) {
+        spec->implicit_const = dw_read_leb128(&abbr, end);
+      }
+      if (atype == 0) {
+        break;
+      }
+      spec->attr = atype;
+      spec->form = aform;
+      spec->size = form_fixed_size(cu, aform);
+
+      if (ab->fixed_size >= 0) {
+        if (spec->size < 0 || atype == DW_AT_sibling) {
+          ab->fixed_size = -1;
+        } else {
+          ab->fixed_size += spec->size;
+        }
+      }
+      ab->nattrs++;
+      spec++;
+    }
+  }
+
+  /* producers almost always number them 1..n in order, which lets
+   * find_abbr index directly */
+  t->dense = 1;
+  for (i = 0; i < nabbrs; i++) {
+    if (t->abbrs[i].code != i + 1) {
+      t->dense = 0;
+      qsort(t->abbrs, nabbrs, sizeof(*ab), compare_abbr);
+      break;
+    }
+  }
+
+  gimli_hash_insert_u64(file->abbr.tables, key, t);
+  return t;
+}
+
+static struct gimli_dwarf_abbr *find_abbr(struct gimli_dwarf_abbr_table *t,
+  uint64_t code)
+{
+  struct gimli_dwarf_abbr key;
+
+  if (!t) {
+    return NULL;
+  }
+  if (t->dense) {
+    if (code == 0 || code > t->nabbrs) {
+      return NULL;
+    }
+    return &t->abbrs[code - 1];
+  }
+  key.code = code;
+  return bsearch(&key, t->abbrs, t->nabbrs, sizeof(key), compare_abbr);
+}
+
+/* Advance data past the attribute values described by abbr.  If the
+ * DIE has a DW_AT_sibling, its .debug_info offset is stored in sibling */
+static const uint8_t *skip_attrs(gimli_mapped_object_t file,
+  struct gimli_dwarf_cu *cu, struct gimli_dwarf_abbr *abbr,
+  const uint8_t *data, const uint8_t *end, uint64_t *sibling)
+{
+  struct gimli_dwarf_abbr_attr *spec;
+  uint64_t form, val;
+  const uint8_t *ptr;
+  uint16_t i;
+
+  *sibling = 0;
+  if (abbr->fixed_size >= 0) {
+    return data + abbr->fixed_size;
+  }
+
+  for (i = 0; i < abbr->nattrs && data < end; i++) {
+    spec = &abbr->attrs[i];
+
+    if (spec->size >= 0 && spec->attr != DW_AT_sibling) {
+      data += spec->size;
+      continue;
+    }
+    form = get_value(spec->form, cu->addr_size, cu->is_64, cu->version,
+        &data, end, &val, &ptr, file->debug_info.elf);
+    if (form == 0) {
+      printf("Failed to resolve value for attribute\n");
+      return end;
+    }
+    if (spec->attr == DW_AT_sibling && form == DW_FORM_ref_udata) {
+      *sibling = cu->offset + val;
+    }
+  }
+  return data;
+}
+
+static const uint8_t *skip_kids(gimli_mapped_object_t file,
+  struct gimli_dwarf_cu *cu, const uint8_t *data, const uint8_t *end);
 
-  while (data < end && abbr < file->abbr.end) {
-    atype = dw_read_uleb128(&abbr, file->abbr.end);
-    aform = dw_read_uleb128(&abbr, file->abbr.end);
+/* Decode the header of the DIE at *datap and advance *datap past its
+ * attributes and, if skip_children is set, past its children too.
+ * Returns 0 for the NUL entry that terminates a list of siblings, or
+ * if the DIE could not be decoded */
+static int scan_die(gimli_mapped_object_t file, struct gimli_dwarf_cu *cu,
+  const uint8_t **datap, const uint8_t *end, int skip_children,
+  struct gimli_dwarf_abbr **abbrp)
+{
+  const uint8_t *data = *datap;
+  uint64_t abbr_code;
+  uint64_t sibling;
+  struct gimli_dwarf_abbr *abbr;
+
+  abbr_code = dw_read_uleb128(&data, end);
+  if (abbr_code == 0) {
+    // Skip over NUL entry
+    *datap = data;
+    return 0;
+  }
+  abbr = find_abbr(cu->abbrs, abbr_code);
+  if (!abbr) {
+    printf("Couldn't locate abbrev code %" PRId64 "\n", abbr_code);
+    *datap = data;
+    return 0;
+  }
+  *abbrp = abbr;
+
+  data = skip_attrs(file, cu, abbr, data, end, &sibling);
 
-    if (atype == 0) {
+  if (abbr->has_children && skip_children) {
+    if (sibling > (uint64_t)(data - file->debug_info.start) &&
+        sibling <= cu->end) {
+      data = file->debug_info.start + sibling;
+    } else {
+      data = skip_kids(file, cu, data, end);
+    }
+  }
+
+  *datap = data;
+  return 1;
+}
+
+/* Advance past a list of siblings and their terminating NUL entry.
+ * The first child may be NULL and not indicate a terminator */
+static const uint8_t *skip_kids(gimli_mapped_object_t file,
+  struct gimli_dwarf_cu *cu, const uint8_t *data, const uint8_t *end)
+{
+  struct gimli_dwarf_abbr *abbr;
+  int nkids = 0;
+
+  while (data < end) {
+    if (scan_die(file, cu, &data, end, 1, &abbr)) {
+      nkids++;
+    } else if (nkids) {
       break;
     }
+  }
+  return data;
+}
+
+/* decode the DIE at *datap into die, skipping over its children */
+static int new_die(gimli_mapped_object_t file,
+  struct gimli_dwarf_cu *cu, const uint8_t **datap, const uint8_t *end,
+  int skip_children, struct gimli_dwarf_die *die)
+{
+  uint64_t offset = *datap - file->debug_info.start;
+  struct gimli_dwarf_abbr *abbr;
+
+  if (!scan_die(file, cu, datap, end, skip_children, &abbr)) {
+    return 0;
+  }
+
+  memset(die, 0, sizeof(*die));
+  die->offset = offset;
+  die->end = *datap - file->debug_info.start;
+  die->tag = abbr->tag;
+  die->cu = cu;
+  die->abbr = abbr;
+  die->has_children = abbr->has_children;
+
+  return 1;
+}
+
+static void load_die_attrs(struct gimli_dwarf_die *die)
+{
+  struct gimli_dwarf_cu *cu = die->cu;
+  gimli_mapped_object_t file = cu->file;
+  const uint8_t *data = file->debug_info.start + die->offset;
+  const uint8_t *end = file->debug_info.start + cu->end;
+  struct gimli_dwarf_abbr_attr *spec;
+  struct gimli_dwarf_attr *attr = NULL;
+
+  die->attrs_loaded = 1;
+
+  if (die->abbr->nattrs == 0) {
+    return;
+  }
+  die->attrs = gimli_slab_alloc_array(&file->attrslab, die->abbr->nattrs);
+
+  /* skip the abbreviation code */
+  dw_read_uleb128(&data, end);
 
-    attr = gimli_slab_alloc(&file->attrslab);
+  while (data < end && die->nattrs < die->abbr->nattrs) {
+    spec = &die->abbr->attrs[die->nattrs];
+    attr = &die->attrs[die->nattrs];
     memset(attr, 0, sizeof(*attr));
-    attr->attr = atype;
+    attr->attr = spec->attr;
 
-    attr->form = get_value(aform, addr_size, is_64, &data, end,
-        &attr->code, &attr->ptr, file->debug_info.elf);
+    if (spec->form == DW_FORM_implicit_const) {
+      /* the value is stored in the abbreviation itself */
+      attr->code = (uint64_t)spec->implicit_const;
+      attr->form = DW_FORM_sdata;
+    } else {
+      attr->form = get_value(spec->form, cu->addr_size, cu->is_64,
+          cu->version, &data, end, &attr->code, &attr->ptr,
+          file->debug_info.elf);
+    }
 
     if (attr->form == 0) {
       printf("Failed to resolve value for attribute\n");
       break;
     }
 
-    if (attr->form == DW_FORM_addr) {
-      attr->code += file->debug_info.reloc;
-    } else if (attr->form == DW_FORM_ref_udata) {
-      /* offset from start of its respective CU */
-//      printf("ref CU, code is %" PRIx64, attr->code);
-      attr->code += (int64_t)(custart - file->debug_info.start);
-//      printf(" fixed up to %" PRIx64 "\n", attr->code);
-      attr->ptr = (const uint8_t*)cu;
-      attr->form = DW_FORM_data8;
+    switch (attr->form) {
+      case DW_FORM_addr:
+        attr->code += file->debug_info.reloc;
+        break;
+      case DW_FORM_ref_udata:
+        /* offset from start of its respective CU */
+        attr->code += cu->offset;
+        attr->ptr = (const uint8_t*)cu;
+        attr->form = DW_FORM_data8;
+        break;
+      case DW_FORM_sec_offset:
+        if (cu->version < 5) {
+          /* an offset into .debug_loc or .debug_ranges */
+          attr->form = DW_FORM_data8;
+          break;
+        }
+        /* an offset into .debug_loclists or .debug_rnglists; those
+         * need the CU to decode their entries */
+        attr->ptr = (const uint8_t*)cu;
+        break;
+      case DW_FORM_strx:
+      case DW_FORM_addrx:
+      case DW_FORM_loclistx:
+      case DW_FORM_rnglistx:
+        /* resolved by gimli_dwarf_die_get_attr */
+        attr->ptr = (const uint8_t*)cu;
+        break;
     }
 
-    attr->next = die->attrs;
-    die->attrs = attr;
-    attr = NULL;
+    die->nattrs++;
   }
+}
 
-  if (has_children) {
-    /* go recursive and pull those in now.
-     * The first child may be NULL and not indicate a terminator */
-    while (1) {
-      kid = process_die(file, cu, custart, &data, end, da_offset,
-            is_64, addr_size);
-      if (kid == NULL) {
-        if (STAILQ_FIRST(&die->kids)) {
-          break;
-        }
-        continue;
+/* returns the first child of die, recording its children if this is
+ * the first time that they have been asked for.  The children are
+ * die->kids[0 .. die->nkids - 1] */
+struct gimli_dwarf_die *gimli_dwarf_die_kids(struct gimli_dwarf_die *die)
+{
+  struct gimli_dwarf_cu *cu = die->cu;
+  gimli_mapped_object_t file = cu->file;
+  const uint8_t *data = file->debug_info.start + die->offset;
+  const uint8_t *end = file->debug_info.start + die->end;
+  struct gimli_dwarf_die *kids = NULL;
+  uint32_t nkids = 0, nalloc = 0, i;
+  uint64_t sibling;
+
+  if (die->kids_loaded) {
+    return die->kids;
+  }
+  die->kids_loaded = 1;
+  if (!die->has_children) {
+    return NULL;
+  }
+
+  dw_read_uleb128(&data, end);
+  data = skip_attrs(file, cu, die->abbr, data, end, &sibling);
+
+  /* decode into a scratch array until we know how many there are.
+   * The first child may be NULL and not indicate a terminator */
+  while (data < end) {
+    if (nkids == nalloc) {
+      nalloc = nalloc ? nalloc * 2 : 16;
+      kids = realloc(kids, nalloc * sizeof(*kids));
+    }
+    if (!new_die(file, cu, &data, end, 1, &kids[nkids])) {
+      if (nkids) {
+        break;
       }
-      STAILQ_INSERT_TAIL(&die->kids, kid, siblings);
-      kid->parent = die;
+      continue;
     }
+    nkids++;
   }
 
-#if 0
-  printf("process_die stopping at offset %" PRIx64 "\n",
-      data - file->debug_info.start);
-#endif
-  *datap = data;
-  return die;
+  if (nkids) {
+    die->kids = gimli_slab_alloc_array(&file->dieslab, nkids);
+    memcpy(die->kids, kids, nkids * sizeof(*kids));
+    die->nkids = nkids;
+    for (i = 0; i < nkids; i++) {
+      die->kids[i].parent = die;
+      gimli_hash_insert_u64(cu->die_by_offset, die->kids[i].offset,
+          &die->kids[i]);
+    }
+  }
+  free(kids);
+
+  return die->kids;
 }
 
 /* Calculate the relocation slide value; it only applies
@@ -1090,6 +1865,30 @@ static int init_debug_info(gimli_mapped_object_t f)
   return 1;
 }
 
+/* returns the start of the unit following the one at data in
+ * .debug_info, or NULL if there is none */
+static const uint8_t *skip_unit(const uint8_t *data, const uint8_t *end)
+{
+  uint64_t initlen;
+  uint32_t len32;
+
+  if (data + sizeof(len32) > end) {
+    return NULL;
+  }
+  memcpy(&len32, data, sizeof(len32));
+  data += sizeof(len32);
+  if (len32 == 0xffffffff) {
+    memcpy(&initlen, data, sizeof(initlen));
+    data += sizeof(initlen);
+  } else {
+    initlen = len32;
+  }
+  if (initlen == 0 || initlen > end - data) {
+    return NULL;
+  }
+  return data + initlen;
+}
+
 /* insert CU into the appropriate portion of the binary search tree
  * pointed to by root */
 static void insert_cu(struct gimli_dwarf_cu **rootp, struct gimli_dwarf_cu *cu)
@@ -1123,17 +1922,20 @@ static void insert_cu(struct gimli_dwarf_cu **rootp, struct gimli_dwarf_cu *cu)
   }
 }
 
+static int gimli_dwarf_die_get_uint64_t_attr(
+  struct gimli_dwarf_die *die, uint64_t attrcode, uint64_t *val);
+
 static struct gimli_dwarf_cu *load_cu(gimli_mapped_object_t f, uint64_t offset)
 {
   const uint8_t *data, *next;
-  const uint8_t *cuend, *custart;
+  const uint8_t *cuend;
   gimli_object_file_t elf = NULL;
   uint64_t initlen;
   uint32_t len32;
   uint16_t ver;
   uint64_t da_offset;
   int is_64 = 0;
-  uint8_t addr_size, seg_size;
+  uint8_t addr_size, seg_size, unit_type = DW_UT_compile;
   struct gimli_dwarf_cu *cu, *cuptr;
   struct gimli_dwarf_die *die = NULL;
 
@@ -1153,7 +1955,6 @@ static struct gimli_dwarf_cu *load_cu(gimli_mapped_object_t f, uint64_t offset)
     return 0;
   }
 
-  custart = data;
   memcpy(&len32, data, sizeof(len32));
   data += sizeof(len32);
   if (len32 == 0xffffffff) {
@@ -1168,30 +1969,52 @@ static struct gimli_dwarf_cu *load_cu(gimli_mapped_object_t f, uint64_t offset)
 
   memcpy(&ver, data, sizeof(ver));
   data += sizeof(ver);
-  if (ver < 2 || ver > 4) {
-    printf("%s: CU @ offset 0x%" PRIx64 " with dwarf version %d; ending processing\n",
+  if (ver < 2 || ver > 5) {
+    printf("%s: CU @ offset 0x%" PRIx64 " with dwarf version %d; skipping\n",
         f->objname, offset, ver);
-    abort();
     return 0;
   }
 
-  if (is_64) {
-    memcpy(&da_offset, data, sizeof(da_offset));
-    data += sizeof(da_offset);
+  if (ver >= 5) {
+    /* DWARF 5 moved the address size ahead of the abbrev offset */
+    memcpy(&unit_type, data, sizeof(unit_type));
+    data += sizeof(unit_type);
+    memcpy(&addr_size, data, sizeof(addr_size));
+    data += sizeof(addr_size);
+    da_offset = read_offset(&data, is_64);
+
+    switch (unit_type) {
+      case DW_UT_skeleton:
+      case DW_UT_split_compile:
+        /* dwo_id */
+        data += sizeof(uint64_t);
+        break;
+      case DW_UT_type:
+      case DW_UT_split_type:
+        /* type_signature and type_offset */
+        data += sizeof(uint64_t);
+        read_offset(&data, is_64);
+        break;
+    }
   } else {
-    memcpy(&len32, data, sizeof(len32));
-    data += sizeof(len32);
-    da_offset = len32;
-  }
+    da_offset = read_offset(&data, is_64);
 
-  memcpy(&addr_size, data, sizeof(addr_size));
-  data += sizeof(addr_size);
+    memcpy(&addr_size, data, sizeof(addr_size));
+    data += sizeof(addr_size);
+  }
 
   cu = calloc(1, sizeof(*cu));
   cu->offset = offset;
   cu->end = cuend - f->debug_info.start;
   cu->da_offset = da_offset;
-  STAILQ_INIT(&cu->dies);
+  cu->version = ver;
+  cu->addr_size = addr_size;
+  cu->is_64 = is_64;
+  cu->file = f;
+  cu->abbrs = load_abbr_table(f, cu);
+  /* references are resolved through this; it grows as DIEs are
+   * recorded, so don't size it for the whole unit up front */
+  cu->die_by_offset = gimli_hash_new_size(NULL, GIMLI_HASH_U64_KEYS, 0);
 
   /* insert into the cu tree */
   insert_cu(&f->debug_info.cus, cu);
@@ -1200,23 +2023,30 @@ static struct gimli_dwarf_cu *load_cu(gimli_mapped_object_t f, uint64_t offset)
       cu->offset, cu->end, cu);
 #endif
 
-  /* now we have a series of Debugging Information Entries (DIE) */
+  /* now we have the unit DIE, which spans the rest of the CU; the
+   * rest of the Debugging Information Entries (DIE) are its
+   * descendants, so don't walk them until they are needed */
+  die = gimli_slab_alloc(&f->dieslab);
   while (data < cuend) {
-    die = process_die(f, cu, custart, &data, cuend,
-        da_offset, is_64, addr_size);
-    if (!die) {
+    if (!new_die(f, cu, &data, cuend, 0, die)) {
       continue;
     }
-    STAILQ_INSERT_TAIL(&cu->dies, die, siblings);
+    die->end = cu->end;
+    gimli_hash_insert_u64(cu->die_by_offset, die->offset, die);
+    cu->die = die;
+
+    /* the unit DIE carries the bases for the indexed forms */
+    gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_str_offsets_base,
+        &cu->str_offsets_base);
+    gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_addr_base,
+        &cu->addr_base);
+    gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_rnglists_base,
+        &cu->rnglists_base);
+    gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_loclists_base,
+        &cu->loclists_base);
+    break;
   }
 
-#if 0
-  printf("abbr.map is %d in size, data size %" PRIu64 " approx %" PRIu64 " per entry\n",
-      gimli_hash_size(f->abbr.map), f->abbr.end - f->abbr.start,
-      (f->abbr.end - f->abbr.start) / gimli_hash_size(f->abbr.map));
-  gimli_hash_diagnose(f->abbr.map);
-#endif
-
   return cu;
 }
 
@@ -1243,32 +2073,48 @@ static struct gimli_dwarf_cu *find_cu(
   return NULL;
 }
 
+/* descend towards offset, recording only the kids of the DIEs
+ * that contain it.  Only used when the DIE hasn't been recorded yet;
+ * the kids recorded along the way go into die_by_offset, so later
+ * references to them and their siblings are a single probe */
 static struct gimli_dwarf_die *find_die_r(struct gimli_dwarf_die *die, uint64_t offset)
 {
-  struct gimli_dwarf_die *kid, *res;
+  struct gimli_dwarf_die *kid;
+  uint32_t lo, hi, mid;
 
-  if (die->offset == offset) {
-    return die;
-  }
-  STAILQ_FOREACH(kid, &die->kids, siblings) {
-    if (kid->offset == offset) {
-      return kid;
+  while (die->offset != offset) {
+    if (offset < die->offset || offset >= die->end) {
+      return NULL;
     }
-  }
-  STAILQ_FOREACH(kid, &die->kids, siblings) {
-    res = find_die_r(kid, offset);
-    if (res) {
-      return res;
+    /* the kids are in offset order; binary search their extents */
+    gimli_dwarf_die_kids(die);
+    lo = 0;
+    hi = die->nkids;
+    kid = NULL;
+    while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (offset < die->kids[mid].offset) {
+        hi = mid;
+      } else if (offset >= die->kids[mid].end) {
+        lo = mid + 1;
+      } else {
+        kid = &die->kids[mid];
+        break;
+      }
+    }
+    if (!kid) {
+      return NULL;
     }
+    die = kid;
   }
-  return NULL;
+  return die;
 }
 
 struct gimli_dwarf_die *gimli_dwarf_get_die(
   gimli_mapped_object_t f,
   uint64_t offset)
 {
-  struct gimli_dwarf_die *die = NULL, *res;
+  struct gimli_dwarf_die *die = NULL;
   struct gimli_dwarf_cu *cu;
 
   cu = find_cu(f, offset);
@@ -1278,26 +2124,139 @@ struct gimli_dwarf_die *gimli_dwarf_get_die(
   }
 
   if (cu) {
-    STAILQ_FOREACH(die, &cu->dies, siblings) {
-      res = find_die_r(die, offset);
-      if (res) {
-        return res;
+    if (gimli_hash_find_u64(cu->die_by_offset, offset, (void**)&die)) {
+      return die;
+    }
+    if (cu->die) {
+      die = find_die_r(cu->die, offset);
+      if (die) {
+        return die;
       }
     }
   }
 
   printf("get_die: %" PRIx64 " MISSING cu=%p %" PRIx64 "-%" PRIx64 "\n",
-      offset, cu, cu->offset, cu->end);
+      offset, cu, cu ? cu->offset : 0, cu ? cu->end : 0);
   return NULL;
 }
 
+/* read a value of the given size from section name at offset */
+static int read_section_value(struct gimli_dwarf_cu *cu, const char *name,
+  uint64_t offset, uint8_t size, uint64_t *val)
+{
+  const uint8_t *start, *end;
+  gimli_object_file_t elf = cu->file->debug_info.elf;
+
+  if (!get_sect_data(cu->file, name, &start, &end, &elf)) {
+    return 0;
+  }
+  if (offset + size > end - start) {
+    return 0;
+  }
+  start += offset;
+  *val = read_addr(&start, size);
+  return 1;
+}
+
+/* resolve an index into .debug_addr; the result is relocated */
+static int resolve_addrx(struct gimli_dwarf_cu *cu, uint64_t idx,
+  uint64_t *addr)
+{
+  if (!read_section_value(cu, ".debug_addr",
+        cu->addr_base + (idx * cu->addr_size), cu->addr_size, addr)) {
+    return 0;
+  }
+  *addr += cu->file->debug_info.reloc;
+  return 1;
+}
+
+/* resolve a loclistx or rnglistx index into an offset from the start
+ * of the respective section */
+static int resolve_listx(struct gimli_dwarf_cu *cu, const char *name,
+  uint64_t base, uint64_t idx, uint64_t *offset)
+{
+  uint8_t size = cu->is_64 ? 8 : 4;
+
+  if (!read_section_value(cu, name, base + (idx * size), size, offset)) {
+    return 0;
+  }
+  *offset += base;
+  return 1;
+}
+
+/* Turn an attribute using one of the DWARF 5 indexed forms into
+ * its direct equivalent.  This is deferred until the attribute is
+ * looked up, as most attributes are never examined */
+static void resolve_indexed_attr(struct gimli_dwarf_attr *attr)
+{
+  struct gimli_dwarf_cu *cu = (struct gimli_dwarf_cu*)attr->ptr;
+  uint64_t val;
+  const uint8_t *str = NULL;
+
+  switch (attr->form) {
+    case DW_FORM_strx:
+      if (read_section_value(cu, ".debug_str_offsets",
+            cu->str_offsets_base + (attr->code * (cu->is_64 ? 8 : 4)),
+            cu->is_64 ? 8 : 4, &val)) {
+        str = get_string(".debug_str", val, cu->file->debug_info.elf);
+      }
+      if (!str) {
+        printf("DWARF: unable to resolve strx %" PRIu64 "\n", attr->code);
+        str = (const uint8_t*)"";
+      }
+      attr->form = DW_FORM_string;
+      attr->ptr = str;
+      attr->code = strlen((char*)str);
+      break;
+
+    case DW_FORM_addrx:
+      if (!resolve_addrx(cu, attr->code, &val)) {
+        printf("DWARF: unable to resolve addrx %" PRIu64 "\n", attr->code);
+        val = 0;
+      }
+      attr->form = DW_FORM_addr;
+      attr->ptr = NULL;
+      attr->code = val;
+      break;
+
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+      if (attr->form == DW_FORM_loclistx) {
+        if (!resolve_listx(cu, ".debug_loclists", cu->loclists_base,
+              attr->code, &val)) {
+          val = 0;
+        }
+      } else if (!resolve_listx(cu, ".debug_rnglists", cu->rnglists_base,
+            attr->code, &val)) {
+        val = 0;
+      }
+      /* now the same as a DWARF 5 DW_FORM_sec_offset */
+      attr->form = DW_FORM_sec_offset;
+      attr->code = val;
+      break;
+  }
+}
+
 struct gimli_dwarf_attr *gimli_dwarf_die_get_attr(
   struct gimli_dwarf_die *die, uint64_t attrcode)
 {
   struct gimli_dwarf_attr *attr;
+  uint16_t i;
 
-  for (attr = die->attrs; attr; attr = attr->next) {
+  if (!die->attrs_loaded) {
+    load_die_attrs(die);
+  }
+  for (i = 0; i < die->nattrs; i++) {
+    attr = &die->attrs[i];
     if (attr->attr == attrcode) {
+      switch (attr->form) {
+        case DW_FORM_strx:
+        case DW_FORM_addrx:
+        case DW_FORM_loclistx:
+        case DW_FORM_rnglistx:
+          resolve_indexed_attr(attr);
+          break;
+      }
       return attr;
     }
   }
@@ -1317,39 +2276,485 @@ static int gimli_dwarf_die_get_uint64_t_attr(
   return 0;
 }
 
-static int sort_compare_arange(const void *A, const void *B)
-{
-  struct dw_die_arange *a = (struct dw_die_arange*)A;
-  struct dw_die_arange *b = (struct dw_die_arange*)B;
-
-  return a->addr - b->addr;
-}
-
-/* Load the DIE location data from an object file */
-static int load_arange(struct gimli_object_mapping *m)
+/* Given a DWARF 5 location list (an offset into .debug_loclists),
+ * evaluate the location that applies to the current pc */
+int dw_calc_loclist(struct gimli_unwind_cursor *cur,
+  uint64_t compilation_unit_base_addr,
+  struct gimli_object_mapping *m, struct gimli_dwarf_attr *attr,
+  uint64_t *res, int *is_stack)
 {
-  struct gimli_section_data *s = NULL;
-  const uint8_t *data, *end, *next;
-  gimli_object_file_t elf = NULL;
-  uint64_t reloc = 0;
-  uint32_t len32;
-  int is_64 = 0;
-  uint64_t initlen;
-  uint16_t ver;
-  uint64_t di_offset;
-  uint8_t addr_size, seg_size;
-  struct gimli_dwarf_die *die;
+  struct gimli_dwarf_cu *cu = (struct gimli_dwarf_cu*)attr->ptr;
+  gimli_object_file_t elf = m->objfile->debug_info.elf;
+  uint64_t reloc = m->objfile->debug_info.reloc;
+  uint64_t base = compilation_unit_base_addr;
+  const uint8_t *data, *end, *expr;
+  uint64_t rstart, rend, len;
+  uint8_t kind;
+  struct dw_loclist *ll;
+  uint32_t alloc = 0;
+
+  ll = find_loclist(m->objfile, (attr->code << 1) | 1);
+  if (ll) {
+    return eval_loclist(cur, m->objfile, ll, res, is_stack);
+  }
 
-  if (!m->objfile->elf) {
-    /* (deleted) */
+  if (!get_sect_data(m->objfile, ".debug_loclists", &data, &end, &elf)) {
+    printf("Couldn't find a .debug_loclists\n");
     return 0;
   }
-  if (!get_sect_data(m->objfile, ".debug_aranges", &data, &end, &elf)) {
+  ll = new_loclist(m->objfile, (attr->code << 1) | 1);
+  data += attr->code;
+
+  while (data < end) {
+    kind = *data++;
+    if (kind == DW_LLE_end_of_list) {
+      break;
+    }
+    switch (kind) {
+      case DW_LLE_base_addressx:
+        if (!resolve_addrx(cu, dw_read_uleb128(&data, end), &base)) {
+          goto done;
+        }
+        continue;
+      case DW_LLE_base_address:
+        base = read_addr(&data, cu->addr_size) + reloc;
+        continue;
+      case DW_LLE_GNU_view_pair:
+        dw_read_uleb128(&data, end);
+        dw_read_uleb128(&data, end);
+        continue;
+      case DW_LLE_startx_endx:
+        if (!resolve_addrx(cu, dw_read_uleb128(&data, end), &rstart) ||
+            !resolve_addrx(cu, dw_read_uleb128(&data, end), &rend)) {
+          goto done;
+        }
+        break;
+      case DW_LLE_startx_length:
+        if (!resolve_addrx(cu, dw_read_uleb128(&data, end), &rstart)) {
+          goto done;
+        }
+        rend = rstart + dw_read_uleb128(&data, end);
+        break;
+      case DW_LLE_offset_pair:
+        rstart = base + dw_read_uleb128(&data, end);
+        rend = base + dw_read_uleb128(&data, end);
+        break;
+      case DW_LLE_default_location:
+        rstart = rend = 0;
+        break;
+      case DW_LLE_start_end:
+        rstart = read_addr(&data, cu->addr_size) + reloc;
+        rend = read_addr(&data, cu->addr_size) + reloc;
+        break;
+      case DW_LLE_start_length:
+        rstart = read_addr(&data, cu->addr_size) + reloc;
+        rend = rstart + dw_read_uleb128(&data, end);
+        break;
+      default:
+        printf("DWARF: unhandled loclists entry 0x%x\n", kind);
+        goto done;
+    }
+
+    /* each of the remaining kinds is followed by a counted location
+     * description */
+    len = dw_read_uleb128(&data, end);
+    expr = data;
+    data += len;
+
+    if (kind == DW_LLE_default_location) {
+      ll->dflt = expr;
+      ll->dflt_len = len;
+      continue;
+    }
+    add_loc_range(ll, &alloc, rstart, rend, expr, len);
+  }
+done:
+  finish_loclist(ll);
+
+  return eval_loclist(cur, m->objfile, ll, res, is_stack);
+}
+
+typedef void (*dw_range_func_t)(void *arg, uint64_t lo, uint64_t hi);
+
+/* Call func for each range in the range list referenced by attr;
+ * either a DWARF 5 .debug_rnglists list, or a .debug_ranges list
+ * for earlier versions */
+static void enum_ranges(gimli_mapped_object_t file,
+  struct gimli_dwarf_attr *attr, uint64_t base,
+  dw_range_func_t func, void *arg)
+{
+  struct gimli_dwarf_cu *cu = (struct gimli_dwarf_cu*)attr->ptr;
+  gimli_object_file_t elf = file->debug_info.elf;
+  uint64_t reloc = file->debug_info.reloc;
+  const uint8_t *data, *end;
+  uint64_t rstart, rend;
+  uint8_t kind;
+
+  if (attr->form != DW_FORM_sec_offset) {
+    if (!get_sect_data(file, ".debug_ranges", &data, &end, &elf)) {
+      return;
+    }
+    data += attr->code;
+    while (data + (2 * sizeof(void*)) <= end) {
+      rstart = read_addr(&data, sizeof(void*));
+      rend = read_addr(&data, sizeof(void*));
+      if (rstart == 0 && rend == 0) {
+        break;
+      }
+      if (rstart == (uint64_t)(intptr_t)-1) {
+        /* base selection */
+        base = rend + reloc;
+        continue;
+      }
+      func(arg, base + rstart, base + rend);
+    }
+    return;
+  }
+
+  if (!get_sect_data(file, ".debug_rnglists", &data, &end, &elf)) {
+    return;
+  }
+  data += attr->code;
+
+  while (data < end) {
+    kind = *data++;
+    switch (kind) {
+      case DW_RLE_end_of_list:
+        return;
+      case DW_RLE_base_addressx:
+        if (!resolve_addrx(cu, dw_read_uleb128(&data, end), &base)) {
+          return;
+        }
+        continue;
+      case DW_RLE_base_address:
+        base = read_addr(&data, cu->addr_size) + reloc;
+        continue;
+      case DW_RLE_startx_endx:
+        if (!resolve_addrx(cu, dw_read_uleb128(&data, end), &rstart) ||
+            !resolve_addrx(cu, dw_read_uleb128(&data, end), &rend)) {
+          return;
+        }
+        break;
+      case DW_RLE_startx_length:
+        if (!resolve_addrx(cu, dw_read_uleb128(&data, end), &rstart)) {
+          return;
+        }
+        rend = rstart + dw_read_uleb128(&data, end);
+        break;
+      case DW_RLE_offset_pair:
+        rstart = base + dw_read_uleb128(&data, end);
+        rend = base + dw_read_uleb128(&data, end);
+        break;
+      case DW_RLE_start_end:
+        rstart = read_addr(&data, cu->addr_size) + reloc;
+        rend = read_addr(&data, cu->addr_size) + reloc;
+        break;
+      case DW_RLE_start_length:
+        rstart = read_addr(&data, cu->addr_size) + reloc;
+        rend = rstart + dw_read_uleb128(&data, end);
+        break;
+      default:
+        printf("DWARF: unhandled rnglists entry 0x%x\n", kind);
+        return;
+    }
+    func(arg, rstart, rend);
+  }
+}
+
+/* Call func for each address range covered by die.
+ * cu_base is the (relocated) low_pc of the containing unit */
+static void enum_die_ranges(gimli_mapped_object_t file,
+  struct gimli_dwarf_die *die, uint64_t cu_base,
+  dw_range_func_t func, void *arg)
+{
+  struct gimli_dwarf_attr *lo, *hi, *ranges;
+  uint64_t lopc, hipc;
+
+  ranges = gimli_dwarf_die_get_attr(die, DW_AT_ranges);
+  if (ranges) {
+    enum_ranges(file, ranges, cu_base, func, arg);
+    return;
+  }
+
+  lo = gimli_dwarf_die_get_attr(die, DW_AT_low_pc);
+  hi = gimli_dwarf_die_get_attr(die, DW_AT_high_pc);
+  if (!lo || !hi) {
+    return;
+  }
+  lopc = lo->code;
+  hipc = hi->code;
+  if (hi->form != DW_FORM_addr) {
+    /* DWARF 4 and later allow this to be an offset from low_pc */
+    hipc += lopc;
+  }
+  func(arg, lopc, hipc);
+}
+
+/* The scope index records the address ranges of every subprogram,
+ * lexical block and inlined subroutine in a CU, sorted so that the
+ * innermost scope for a pc can be found with a binary search followed
+ * by a short walk out through the enclosing ranges */
+struct scope_builder {
+  struct gimli_dwarf_scope *scopes;
+  uint32_t nscopes, alloc;
+  struct gimli_dwarf_die *die;
+  uint32_t depth;
+  int added;
+};
+
+static void add_scope(void *arg, uint64_t lo, uint64_t hi)
+{
+  struct scope_builder *b = arg;
+  struct gimli_dwarf_scope *s;
+
+  if (hi <= lo) {
+    return;
+  }
+  if (b->nscopes == b->alloc) {
+    b->alloc = b->alloc ? b->alloc * 2 : 64;
+    b->scopes = realloc(b->scopes, b->alloc * sizeof(*s));
+  }
+  s = &b->scopes[b->nscopes++];
+  s->lo = lo;
+  s->hi = hi;
+  s->die = b->die;
+  s->depth = b->depth;
+  s->parent = -1;
+  b->added = 1;
+}
+
+static void index_scopes(gimli_mapped_object_t file,
+  struct scope_builder *b, struct gimli_dwarf_die *die, uint64_t cu_base)
+{
+  struct gimli_dwarf_die *kid;
+
+  GIMLI_DWARF_DIE_FOREACH_KID(kid, die) {
+    switch (kid->tag) {
+      case DW_TAG_subprogram:
+      case DW_TAG_lexical_block:
+      case DW_TAG_inlined_subroutine:
+        b->die = kid;
+        b->added = 0;
+        enum_die_ranges(file, kid, cu_base, add_scope, b);
+        /* abstract instances and declarations have no code, and
+         * neither do their kids */
+        if (b->added) {
+          b->depth++;
+          index_scopes(file, b, kid, cu_base);
+          b->depth--;
+        }
+        break;
+      case DW_TAG_namespace:
+        b->depth++;
+        index_scopes(file, b, kid, cu_base);
+        b->depth--;
+        break;
+    }
+  }
+}
+
+static int sort_compare_scope(const void *A, const void *B)
+{
+  const struct gimli_dwarf_scope *a = A, *b = B;
+
+  if (a->lo != b->lo) {
+    return a->lo < b->lo ? -1 : 1;
+  }
+  /* enclosing ranges first */
+  if (a->hi != b->hi) {
+    return a->hi > b->hi ? -1 : 1;
+  }
+  return (int)a->depth - (int)b->depth;
+}
+
+static void build_scope_index(struct gimli_dwarf_cu *cu)
+{
+  struct scope_builder b;
+  uint64_t cu_base = 0;
+  int32_t *stack;
+  uint32_t i, sp = 0;
+
+  cu->scopes_built = 1;
+  if (!cu->die) {
+    return;
+  }
+
+  memset(&b, 0, sizeof(b));
+  gimli_dwarf_die_get_uint64_t_attr(cu->die, DW_AT_low_pc, &cu_base);
+  index_scopes(cu->file, &b, cu->die, cu_base);
+  if (!b.nscopes) {
+    return;
+  }
+
+  qsort(b.scopes, b.nscopes, sizeof(*b.scopes), sort_compare_scope);
+
+  /* link each range to the closest range that encloses it */
+  stack = malloc(b.nscopes * sizeof(*stack));
+  for (i = 0; i < b.nscopes; i++) {
+    while (sp && b.scopes[stack[sp-1]].hi <= b.scopes[i].lo) {
+      sp--;
+    }
+    b.scopes[i].parent = sp ? stack[sp-1] : -1;
+    stack[sp++] = i;
+  }
+  free(stack);
+
+  cu->scopes = b.scopes;
+  cu->nscopes = b.nscopes;
+}
+
+/* returns the innermost subprogram, lexical block or inlined
+ * subroutine in cu that contains pc */
+static struct gimli_dwarf_die *find_scope(struct gimli_dwarf_cu *cu,
+  gimli_addr_t pc)
+{
+  uint32_t lo = 0, hi, mid;
+  int32_t i;
+
+  if (!cu->scopes_built) {
+    build_scope_index(cu);
+  }
+
+  /* find the last range starting at or before pc */
+  hi = cu->nscopes;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (cu->scopes[mid].lo <= pc) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (i = (int32_t)lo - 1; i >= 0; i = cu->scopes[i].parent) {
+    if (pc < cu->scopes[i].hi) {
+      return cu->scopes[i].die;
+    }
+  }
+  return NULL;
+}
+
+static int sort_compare_arange(const void *A, const void *B)
+{
+  struct dw_die_arange *a = (struct dw_die_arange*)A;
+  struct dw_die_arange *b = (struct dw_die_arange*)B;
+
+  if (a->addr < b->addr) return -1;
+  if (a->addr > b->addr) return 1;
+  return 0;
+}
+
+static void add_arange(gimli_mapped_object_t file, uint64_t addr,
+  uint64_t len, uint64_t di_offset)
+{
+  struct dw_die_arange *arange;
+
+  if (file->num_arange + 1 >= file->alloc_arange) {
+    file->alloc_arange = file->alloc_arange ? file->alloc_arange * 2 : 1024;
+    file->arange = realloc(file->arange, file->alloc_arange * sizeof(*arange));
+  }
+  arange = &file->arange[file->num_arange++];
+  arange->addr = addr;
+  arange->len = len;
+  arange->di_offset = di_offset;
+}
+
+struct synth_arange {
+  gimli_mapped_object_t file;
+  uint64_t di_offset;
+};
+
+static void add_synth_arange(void *arg, uint64_t lo, uint64_t hi)
+{
+  struct synth_arange *s = arg;
+
+  if (hi > lo) {
+    add_arange(s->file, lo, hi - lo, s->di_offset);
+  }
+}
+
+/* .debug_aranges is optional and is missing from, or incomplete in,
+ * plenty of objects (clang, LTO builds).  Add entries for any CU
+ * that it doesn't mention using the ranges of the CU's unit DIE.
+ * This only decodes the unit header and unit DIE of those CUs */
+static void synthesize_arange(gimli_mapped_object_t file)
+{
+  const uint8_t *start, *end, *data, *next;
+  gimli_object_file_t elf = NULL;
+  gimli_hash_t covered;
+  struct gimli_dwarf_cu *cu;
+  struct synth_arange s;
+  uint64_t cu_base;
+  uint32_t i;
+
+  if (!file->debug_info.start &&
+      !get_sect_data(file, ".debug_info", &start, &end, &elf)) {
+    return;
+  }
+  if (!init_debug_info(file)) {
+    return;
+  }
+
+  covered = gimli_hash_new_size(NULL, GIMLI_HASH_U64_KEYS, 0);
+  for (i = 0; i < file->num_arange; i++) {
+    gimli_hash_insert_u64(covered, file->arange[i].di_offset, NULL);
+  }
+
+  s.file = file;
+  for (data = file->debug_info.start;
+      (next = skip_unit(data, file->debug_info.end)) != NULL;
+      data = next) {
+    s.di_offset = data - file->debug_info.start;
+
+    if (gimli_hash_find_u64(covered, s.di_offset, NULL)) {
+      continue;
+    }
+
+    cu = find_cu(file, s.di_offset);
+    if (!cu) {
+      cu = load_cu(file, s.di_offset);
+    }
+    if (!cu || !cu->die) {
+      continue;
+    }
+    cu_base = 0;
+    gimli_dwarf_die_get_uint64_t_attr(cu->die, DW_AT_low_pc, &cu_base);
+    enum_die_ranges(file, cu->die, cu_base, add_synth_arange, &s);
+  }
+
+  gimli_hash_destroy(covered);
+}
+
+/* Load the DIE location data from an object file */
+static int load_arange(struct gimli_object_mapping *m)
+{
+  struct gimli_section_data *s = NULL;
+  const uint8_t *data, *end, *next;
+  gimli_object_file_t elf = NULL;
+  uint64_t reloc = 0;
+  uint32_t len32;
+  int is_64 = 0;
+  uint64_t initlen;
+  uint16_t ver;
+  uint64_t di_offset;
+  uint8_t addr_size, seg_size;
+  struct gimli_dwarf_die *die;
+
+  if (m->objfile->arange_loaded) {
+    return m->objfile->num_arange > 0;
+  }
+  if (!m->objfile->elf) {
+    /* (deleted) */
     return 0;
   }
+  m->objfile->arange_loaded = 1;
 
   reloc = calc_reloc(m->objfile);
 
+  if (!get_sect_data(m->objfile, ".debug_aranges", &data, &end, &elf)) {
+    data = end = NULL;
+  }
+
   while (data < end) {
     uint64_t mask;
 
@@ -1387,7 +2792,7 @@ static int load_arange(struct gimli_object_mapping *m)
 
     if (seg_size) {
       printf("DWARF: I don't support segmented debug_aranges data\n");
-      return 0;
+      break;
     }
 
 //    printf("arange: ver %d addr_size %d seg %d\n", ver, addr_size, seg_size);
@@ -1401,7 +2806,6 @@ static int load_arange(struct gimli_object_mapping *m)
       /* now we have a series of tuples */
       gimli_addr_t addr;
       uint64_t l;
-      struct dw_die_arange *arange;
 
       if (addr_size == 8) {
         memcpy(&l, data, sizeof(l));
@@ -1429,27 +2833,21 @@ static int load_arange(struct gimli_object_mapping *m)
       }
 
       addr += reloc;
-
-      if (m->objfile->num_arange + 1 >= m->objfile->alloc_arange) {
-        m->objfile->alloc_arange = m->objfile->alloc_arange ? m->objfile->alloc_arange * 2 : 1024;
-        m->objfile->arange = realloc(m->objfile->arange, m->objfile->alloc_arange * sizeof(*arange));
-      }
-      arange = &m->objfile->arange[m->objfile->num_arange++];
-      arange->addr = addr;
-      arange->len = l;
-      arange->di_offset = di_offset;
+      add_arange(m->objfile, addr, l, di_offset);
 
 //      printf("arange: addr=" PTRFMT " 0x%" PRIx64 "\n", addr, l);
     }
     data = next;
   }
 
+  synthesize_arange(m->objfile);
+
   /* ensure ascending order */
   qsort(m->objfile->arange, m->objfile->num_arange, sizeof(struct dw_die_arange),
       sort_compare_arange);
 //printf("sorting %d arange in %s\n", m->objfile->num_arange, m->objfile->objname);
 
-  return 1;
+  return m->objfile->num_arange > 0;
 }
 
 static int search_compare_arange(const void *K, const void *R)
@@ -1468,116 +2866,167 @@ static int search_compare_arange(const void *K, const void *R)
   return 1;
 }
 
-/* Given a CU, locate the DIE corresponding to the provided data address */
-static struct gimli_dwarf_die *find_var_die_for_addr(gimli_proc_t proc,
-    struct gimli_object_mapping *m,
-    struct gimli_dwarf_cu *cu, gimli_addr_t addr)
+/* the size in bytes of the type that attr refers to, worked out from
+ * its DIEs so that the type itself needn't be built */
+static uint64_t type_attr_size(gimli_mapped_object_t file,
+  struct gimli_dwarf_attr *type)
 {
   struct gimli_dwarf_die *die, *kid;
-  struct gimli_unwind_cursor cur;
-  uint64_t frame_base = 0;
-  uint64_t comp_unit_base = 0;
-  int is_stack = 0;
-  struct gimli_dwarf_attr *frame_base_attr;
+  uint64_t size, n, count;
+  int depth;
 
-  memset(&cur, 0, sizeof(cur));
-  cur.proc = proc;
-#ifdef __MACH__
-  addr -= m->objfile->base_addr;
-#endif
+  for (depth = 0; type && depth < 32; depth++) {
+    die = gimli_dwarf_get_die(file, type->code);
+    if (!die) {
+      return 0;
+    }
+    if (gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_byte_size, &size)) {
+      return size;
+    }
+    switch (die->tag) {
+      case DW_TAG_pointer_type:
+        return die->cu->addr_size;
+      case DW_TAG_array_type:
+        n = 1;
+        GIMLI_DWARF_DIE_FOREACH_KID(kid, die) {
+          if (kid->tag != DW_TAG_subrange_type) {
+            continue;
+          }
+          if (gimli_dwarf_die_get_uint64_t_attr(kid, DW_AT_count, &count)) {
+            n *= count;
+          } else if (gimli_dwarf_die_get_uint64_t_attr(kid,
+                DW_AT_upper_bound, &count)) {
+            n *= count + 1;
+          } else {
+            /* flexible array */
+            n = 0;
+          }
+        }
+        return n * type_attr_size(file,
+            gimli_dwarf_die_get_attr(die, DW_AT_type));
+    }
+    /* typedefs and qualifiers */
+    type = gimli_dwarf_die_get_attr(die, DW_AT_type);
+  }
+  return 0;
+}
 
-  STAILQ_FOREACH(die, &cu->dies, siblings) {
-    uint64_t lopc, hipc;
+/* record the variables at the top level of a CU, and within its
+ * namespaces, whose location is a plain address */
+static void index_globals(gimli_mapped_object_t file,
+  struct gimli_dwarf_die *die, uint32_t *alloc)
+{
+  struct gimli_dwarf_die *kid, *spec;
+  struct gimli_dwarf_attr *loc, *type;
+  struct dw_die_global *g;
+  const uint8_t *ptr, *end;
+  uint64_t addr;
 
-    if (die->tag != DW_TAG_compile_unit) {
-      printf("DIE is not a compile unit!? tag=0x%" PRIx64 "\n", die->tag);
+  GIMLI_DWARF_DIE_FOREACH_KID(kid, die) {
+    if (kid->tag == DW_TAG_namespace) {
+      index_globals(file, kid, alloc);
+      continue;
+    }
+    if (kid->tag != DW_TAG_variable) {
+      continue;
+    }
+    loc = gimli_dwarf_die_get_attr(kid, DW_AT_location);
+    if (!loc || loc->form != DW_FORM_block || loc->code == 0) {
       continue;
     }
 
-    gimli_dwarf_die_get_uint64_t_attr(die,
-        DW_AT_low_pc, &comp_unit_base);
+    ptr = loc->ptr;
+    end = ptr + loc->code;
+    switch (*ptr++) {
+      case DW_OP_addr:
+        if (end - ptr != kid->cu->addr_size) {
+          continue;
+        }
+        addr = read_addr(&ptr, kid->cu->addr_size) + calc_reloc(file);
+        break;
+      case DW_OP_addrx:
+        addr = dw_read_uleb128(&ptr, end);
+        if (ptr != end || !resolve_addrx(kid->cu, addr, &addr)) {
+          continue;
+        }
+        break;
+      default:
+        /* TLS and computed locations */
+        continue;
+    }
 
-    frame_base_attr = gimli_dwarf_die_get_attr(die, DW_AT_frame_base);
-    if (frame_base_attr) {
-      switch (frame_base_attr->form) {
-        case DW_FORM_block:
-          dw_eval_expr(&cur, (uint8_t*)frame_base_attr->ptr, frame_base_attr->code,
-              0, &frame_base, NULL, &is_stack);
-          break;
-        case DW_FORM_data8:
-          dw_calc_location(&cur, comp_unit_base, m,
-              frame_base_attr->code, &frame_base, NULL, &is_stack);
-          break;
-        default:
-          printf("Unhandled frame base form 0x%" PRIx64 "\n",
-              frame_base_attr->form);
-          return 0;
-      }
+    /* the definition of a C++ static member carries its type on the
+     * declaration in the class */
+    type = gimli_dwarf_die_get_attr(kid, DW_AT_type);
+    if (!type) {
+      type = gimli_dwarf_die_get_attr(kid, DW_AT_specification);
+      spec = type ? gimli_dwarf_get_die(file, type->code) : NULL;
+      type = spec ? gimli_dwarf_die_get_attr(spec, DW_AT_type) : NULL;
     }
 
-    /* this is the die for the compilation unit; we need to walk
-     * through it and find the data it contains */
-    STAILQ_FOREACH(kid, &die->kids, siblings) {
-      uint64_t res = 0;
-      is_stack = 1;
-      struct gimli_dwarf_attr *location, *type, *name;
+    if (file->num_globals + 1 >= *alloc) {
+      *alloc = *alloc ? *alloc * 2 : 256;
+      file->globals = realloc(file->globals, *alloc * sizeof(*g));
+    }
+    g = &file->globals[file->num_globals++];
+    g->addr = addr;
+    g->size = type ? type_attr_size(file, type) : 0;
+    g->die_offset = kid->offset;
+  }
+}
 
-      if (kid->tag != DW_TAG_variable && kid->tag != DW_TAG_constant) {
-//        printf("skipping kid with tag 0x%" PRIx64 "\n", kid->tag);
-        continue;
-      }
+static int sort_compare_global(const void *A, const void *B)
+{
+  struct dw_die_global *a = (struct dw_die_global*)A;
+  struct dw_die_global *b = (struct dw_die_global*)B;
 
-      location = gimli_dwarf_die_get_attr(kid, DW_AT_location);
-      if (!location) {
-        continue;
-      }
+  if (a->addr < b->addr) return -1;
+  if (a->addr > b->addr) return 1;
+  return 0;
+}
 
-      switch (location->form) {
-        case DW_FORM_block:
-          if (!dw_eval_expr(&cur, (uint8_t*)location->ptr, location->code,
-                frame_base, &res, NULL, &is_stack)) {
-            res = 0;
-          }
-          break;
-        case DW_FORM_data8:
-          if (!dw_calc_location(&cur, comp_unit_base, m,
-                location->code, &res, NULL, &is_stack)) {
-            res = 0;
-          }
-          break;
-        default:
-          printf("Unhandled location form 0x%" PRIx64 "\n", location->form);
-          res = 0;
-      }
+/* Build the address-sorted table of the variables with static
+ * storage in an object.  Only the DIEs at the top of each CU are
+ * decoded, and no types are built */
+static void build_global_index(gimli_mapped_object_t file)
+{
+  struct gimli_dwarf_cu *cu;
+  const uint8_t *cuptr, *next;
+  uint64_t off;
+  uint32_t alloc = 0;
 
-      if (res == addr) {
-        return kid;
-      }
+  file->globals_built = 1;
+  if (!init_debug_info(file)) {
+    return;
+  }
+
+  for (cuptr = file->debug_info.start;
+      (next = skip_unit(cuptr, file->debug_info.end)) != NULL;
+      cuptr = next) {
+    off = cuptr - file->debug_info.start;
+    cu = find_cu(file, off);
+    if (!cu) {
+      cu = load_cu(file, off);
+    }
+    if (cu && cu->die) {
+      index_globals(file, cu->die, &alloc);
     }
   }
 
-  /* no joy */
-  return NULL;
+  qsort(file->globals, file->num_globals, sizeof(struct dw_die_global),
+      sort_compare_global);
 }
 
-/* attempt to locate a DW_TAG_variable or DW_TAG_constant die
- * corresponding to the provided data address.
- * We make this attempt using the debug_aranges data, but it
- * may not be successful, as gcc doesn't appear to generate
- * it for the data segment, despite the DWARF standard indicating
- * that it can be used in that fashion.
- * In that case, we have to fall back to crawling the CU data.
- * */
+/* Locate the DW_TAG_variable DIE whose storage contains the provided
+ * data address.  gcc doesn't describe the data segment in
+ * .debug_aranges, so we keep our own table of the variables */
 static struct gimli_dwarf_die *gimli_dwarf_get_die_for_data(
     gimli_proc_t proc, gimli_addr_t pc)
 {
   struct gimli_object_mapping *m;
-  struct gimli_dwarf_cu *cu;
-  struct dw_die_arange *arange;
-  struct gimli_dwarf_die *die;
   gimli_mapped_object_t file;
-  const uint8_t *cuptr;
-  uint64_t off;
+  struct dw_die_global *g;
+  uint32_t lo, hi, mid;
 
   m = gimli_mapping_for_addr(proc, pc);
   if (!m) {
@@ -1588,51 +3037,41 @@ static struct gimli_dwarf_die *gimli_dwarf_get_die_for_data(
   if (!file->elf) {
     return NULL;
   }
-
-  if (!file->arange && !load_arange(m)) {
+  if (!file->globals_built) {
+    build_global_index(file);
+  }
+  if (!file->num_globals) {
     return NULL;
   }
 #ifdef __MACH__
-  pc -= m->objfile->base_addr;
-#endif
-  arange = bsearch(&pc, file->arange, file->num_arange,
-      sizeof(*arange), search_compare_arange);
-#ifdef __MACH__
-  pc += m->objfile->base_addr;
+  pc -= file->base_addr;
 #endif
 
-  if (arange) {
-    /* arange gives us a pointer to the CU */
-    cu = find_cu(file, arange->di_offset);
-    if (!cu) {
-      cu = load_cu(file, arange->di_offset);
-    }
-    if (cu) {
-      return find_var_die_for_addr(proc, m, cu, pc);
+  /* find the last variable that starts at or below pc */
+  lo = 0;
+  hi = file->num_globals;
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (file->globals[mid].addr <= pc) {
+      lo = mid;
+    } else {
+      hi = mid;
     }
   }
-
-  cuptr = file->debug_info.start;
-  while (cuptr < file->debug_info.end) {
-    off = cuptr - file->debug_info.start;
-    cu = find_cu(file, off);
-    if (!cu) {
-      cu = load_cu(file, off);
-    }
-    if (!cu) break;
-    cuptr = file->debug_info.start + cu->end;
-
-    die = find_var_die_for_addr(proc, m, cu, pc);
-    if (die) return die;
+  g = &file->globals[lo];
+  if (pc < g->addr || pc >= g->addr + (g->size ? g->size : 1)) {
+    return NULL;
   }
 
-  return NULL;
+  return gimli_dwarf_get_die(file, g->die_offset);
 }
 
-struct gimli_dwarf_die *gimli_dwarf_get_die_for_pc(gimli_proc_t proc, gimli_addr_t pc)
+/* returns the innermost subprogram, lexical block or inlined
+ * subroutine that contains pc */
+static struct gimli_dwarf_die *find_scope_for_pc(gimli_proc_t proc,
+  gimli_addr_t pc)
 {
   struct gimli_object_mapping *m;
-  struct gimli_dwarf_die *die, *kid;
   struct gimli_dwarf_cu *cu;
   struct dw_die_arange *arange;
 
@@ -1663,45 +3102,29 @@ struct gimli_dwarf_die *gimli_dwarf_get_die_for_pc(gimli_proc_t proc, gimli_addr
   if (!cu) {
     cu = load_cu(m->objfile, arange->di_offset);
   }
-  if (!cu) {
+  if (!cu || !cu->die) {
 //    printf("no CU for pc " PTRFMT " arange said off %" PRIx64 "\n", pc, arange->di_offset);
     return NULL;
   }
 
-//  printf("got CU " PTRFMT " - " PTRFMT " arange said off %" PRIx64 "\n", cu->offset, cu->end, arange->di_offset);
-
-  STAILQ_FOREACH(die, &cu->dies, siblings) {
-    uint64_t lopc, hipc;
-
-    if (die->tag != DW_TAG_compile_unit) {
-      printf("DIE is not a compile unit!? tag=0x%" PRIx64 "\n", die->tag);
-      continue;
-    }
-
-    /* this is the die for the compilation unit; we need to walk
-     * through it and find the subprogram that matches */
-    STAILQ_FOREACH(kid, &die->kids, siblings) {
-      lopc = arange->addr;
-      hipc = arange->len;
+  if (cu->die->tag != DW_TAG_compile_unit) {
+    printf("DIE is not a compile unit!? tag=0x%x\n", cu->die->tag);
+    return NULL;
+  }
 
-      if (kid->tag != DW_TAG_subprogram) {
-        continue;
-      }
+  return find_scope(cu, pc);
+}
 
-      if (!gimli_dwarf_die_get_uint64_t_attr(kid, DW_AT_low_pc, &lopc)) {
-        continue;
-      }
-      if (!gimli_dwarf_die_get_uint64_t_attr(kid, DW_AT_high_pc, &hipc)) {
-        continue;
-      }
+/* returns the subprogram that contains pc */
+struct gimli_dwarf_die *gimli_dwarf_get_die_for_pc(gimli_proc_t proc, gimli_addr_t pc)
+{
+  struct gimli_dwarf_die *die;
 
-      if (pc >= lopc && pc <= hipc) {
-        return kid;
-      }
+  for (die = find_scope_for_pc(proc, pc); die; die = die->parent) {
+    if (die->tag == DW_TAG_subprogram) {
+      return die;
     }
   }
-
-  /* no joy */
   return NULL;
 }
 
@@ -1747,8 +3170,9 @@ static gimli_type_t load_type(
 static void populate_struct_or_union(
     gimli_type_t t,
     gimli_mapped_object_t file,
-    struct gimli_dwarf_die *die)
+    struct gimli_dwarf_die *parent)
 {
+  struct gimli_dwarf_die *die;
   struct gimli_dwarf_attr *loc, *type, *mname;
   uint64_t root = 0;
   struct gimli_unwind_cursor cur;
@@ -1759,7 +3183,7 @@ static void populate_struct_or_union(
 
   memset(&cur, 0, sizeof(cur));
 
-  STAILQ_FOREACH(die, &die->kids, siblings) {
+  GIMLI_DWARF_DIE_FOREACH_KID(die, parent) {
     if (die->tag != DW_TAG_member) continue;
 
     loc = gimli_dwarf_die_get_attr(die, DW_AT_data_member_location);
@@ -1772,8 +3196,12 @@ static void populate_struct_or_union(
         printf("unable to evaluate member location\n");
         root = 0;
       }
+    } else if (loc && (loc->form == DW_FORM_data8 ||
+          loc->form == DW_FORM_udata || loc->form == DW_FORM_sdata)) {
+      /* DWARF 3 and later allow a constant byte offset */
+      root = loc->code;
     } else if (loc) {
-      printf("Unhandled location form 0x%" PRIx64 " for struct member\n",
+      printf("Unhandled location form 0x%x for struct member\n",
           loc->form);
     }
     type = gimli_dwarf_die_get_attr(die, DW_AT_type);
@@ -1788,7 +3216,12 @@ static void populate_struct_or_union(
       continue;
     }
     offset = 0;
-    if (gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_bit_size, &size)) {
+    if (gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_bit_size, &size) &&
+        gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_data_bit_offset,
+          &offset)) {
+      /* DWARF 4 and later: bit offset from the start of the struct */
+      root = 0;
+    } else if (gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_bit_size, &size)) {
       uint64_t bytesize;
 
       if (!gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_bit_offset, &offset)) {
@@ -1818,11 +3251,12 @@ static gimli_type_t array_dim(gimli_mapped_object_t file,
   uint64_t uval;
   struct gimli_dwarf_attr *type;
   gimli_type_t t, target;
+  struct gimli_dwarf_die *next = die + 1;
 
   memset(&info, 0, sizeof(info));
 
-  if (STAILQ_NEXT(die, siblings)) {
-    info.contents = array_dim(file, STAILQ_NEXT(die, siblings), eletype);
+  if (next < die->parent->kids + die->parent->nkids) {
+    info.contents = array_dim(file, next, eletype);
   } else {
     info.contents = eletype;
   }
@@ -1843,7 +3277,8 @@ static gimli_type_t populate_array(gimli_mapped_object_t file,
   gimli_type_t t;
   struct gimli_dwarf_attr *type;
 
-  if (!STAILQ_FIRST(&die->kids) || STAILQ_FIRST(&die->kids)->tag != DW_TAG_subrange_type) {
+  if (!gimli_dwarf_die_kids(die) ||
+      die->kids[0].tag != DW_TAG_subrange_type) {
     printf("cannot determine array bounds!\n");
     return NULL;
   }
@@ -1855,7 +3290,7 @@ static gimli_type_t populate_array(gimli_mapped_object_t file,
     return NULL;
   }
 
-  t = array_dim(file, STAILQ_FIRST(&die->kids), t);
+  t = array_dim(file, &die->kids[0], t);
   return t;
 }
 
@@ -1885,7 +3320,7 @@ static gimli_type_t populate_func(gimli_mapped_object_t file,
   }
 
   /* are we variadic? */
-  STAILQ_FOREACH(kid, &die->kids, siblings) {
+  GIMLI_DWARF_DIE_FOREACH_KID(kid, die) {
     if (kid->tag == DW_TAG_unspecified_parameters) {
       flags = GIMLI_FUNC_VARARG;
       break;
@@ -1894,7 +3329,7 @@ static gimli_type_t populate_func(gimli_mapped_object_t file,
 
   t = gimli_type_new_function(file->types, name, flags, rettype);
 
-  STAILQ_FOREACH(kid, &die->kids, siblings) {
+  GIMLI_DWARF_DIE_FOREACH_KID(kid, die) {
     if (kid->tag == DW_TAG_unspecified_parameters) {
       continue;
     }
@@ -1922,11 +3357,11 @@ static int populate_enum(gimli_type_t t,
   struct gimli_dwarf_die *die;
   struct gimli_dwarf_attr *name = NULL;
 
-  STAILQ_FOREACH(die, &parent->kids, siblings) {
+  GIMLI_DWARF_DIE_FOREACH_KID(die, parent) {
     struct gimli_dwarf_attr *cv;
 
     if (die->tag != DW_TAG_enumerator) {
-      printf("unexpected tag 0x%" PRIx64 " in enumeration_type\n",
+      printf("unexpected tag 0x%x in enumeration_type\n",
           die->tag);
       return 0;
     }
@@ -1946,6 +3381,85 @@ static int populate_enum(gimli_type_t t,
   return 1;
 }
 
+/* Renders the full path of a file of the line program into buf,
+ * joining it with its directory and, for paths relative to the
+ * compilation directory, with comp_dir if that is known */
+static const char *line_file_path(struct gimli_line_program *lp,
+  uint64_t fileno, const char *comp_dir, char *buf, size_t len)
+{
+  const char *name = lp->files[fileno];
+  const char *dir = NULL;
+
+  if (name[0] == '/') {
+    return name;
+  }
+  if (lp->file_dirs[fileno] < lp->ndirs) {
+    dir = lp->dirs[lp->file_dirs[fileno]];
+  }
+  if (dir && (dir[0] == '/' || !comp_dir)) {
+    snprintf(buf, len, "%s/%s", dir, name);
+  } else if (dir) {
+    snprintf(buf, len, "%s/%s/%s", comp_dir, dir, name);
+  } else if (comp_dir) {
+    snprintf(buf, len, "%s/%s", comp_dir, name);
+  } else {
+    return name;
+  }
+  return buf;
+}
+
+/* Every CU that includes a header carries its own copy of the types
+ * declared there.  Structs, unions and enums are identified across
+ * CUs by their kind, name and size together with the source position
+ * of their declaration, so that the copies share one gimli_type_t.
+ * The declaring file is identified by its full path, as headers in
+ * different directories may well share a name; the interned copy of
+ * the path stands in for it, keeping the key short.
+ * Returns 0 if the DIE doesn't say where it was declared */
+static int aggregate_key(gimli_mapped_object_t file,
+    struct gimli_dwarf_die *die, const char *type_name,
+    char *key, size_t keylen)
+{
+  uint64_t fileno, line, column = 0, size = 0, offset;
+  struct gimli_line_program *lp;
+  struct gimli_dwarf_attr *comp_dir;
+  char path[1024];
+
+  if (gimli_dwarf_die_get_attr(die, DW_AT_declaration)) {
+    /* an incomplete type has nothing to it besides its name */
+    if (!type_name) {
+      return 0;
+    }
+    snprintf(key, keylen, "%x:%p:decl", die->tag,
+        (void*)gimli_intern(type_name));
+    return 1;
+  }
+
+  if (!gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_decl_file, &fileno) ||
+      !gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_decl_line, &line) ||
+      !gimli_dwarf_die_get_uint64_t_attr(die->cu->die,
+        DW_AT_stmt_list, &offset)) {
+    return 0;
+  }
+  /* file numbers are local to the CU's line number program */
+  lp = load_line_program(file, offset);
+  if (!lp || fileno >= lp->nfiles || !lp->files[fileno]) {
+    return 0;
+  }
+  gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_decl_column, &column);
+  gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_byte_size, &size);
+  comp_dir = gimli_dwarf_die_get_attr(die->cu->die, DW_AT_comp_dir);
+
+  /* names and paths are keyed by their interned addresses, so that
+   * long template names can't be truncated into the same key */
+  snprintf(key, keylen, "%x:%p:%" PRIu64 ":%p:%" PRIu64 ":%" PRIu64,
+      die->tag, (void*)gimli_intern(type_name), size,
+      gimli_intern(line_file_path(lp, fileno,
+          comp_dir ? (char*)comp_dir->ptr : NULL, path, sizeof(path))),
+      line, column);
+  return 1;
+}
+
 static gimli_type_t load_type_die(
     gimli_mapped_object_t file,
     struct gimli_dwarf_die *die)
@@ -1956,6 +3470,8 @@ static gimli_type_t load_type_die(
   const char *type_name = NULL;
   struct gimli_dwarf_attr *name = NULL;
   struct gimli_dwarf_attr *type = NULL;
+  char key[128];
+  int keyed;
 
   if (file->die_to_type) {
     if (gimli_hash_find_ptr(file->die_to_type, die, (void**)&t)) {
@@ -2084,14 +3600,24 @@ static gimli_type_t load_type_die(
       break;
 
     case DW_TAG_structure_type:
-      t = gimli_type_new_struct(file->types, type_name);
-      gimli_hash_insert_ptr(file->die_to_type, die, t);
-      populate_struct_or_union(t, file, die);
-      return t;
-
     case DW_TAG_union_type:
-      t = gimli_type_new_union(file->types, type_name);
+      keyed = aggregate_key(file, die, type_name, key, sizeof(key));
+      if (keyed) {
+        t = gimli_type_collection_find_interned(file->types, key);
+        if (t) {
+          break;
+        }
+      }
+      if (die->tag == DW_TAG_structure_type) {
+        t = gimli_type_new_struct(file->types, type_name);
+      } else {
+        t = gimli_type_new_union(file->types, type_name);
+      }
+      /* register it before the members, which may refer back to it */
       gimli_hash_insert_ptr(file->die_to_type, die, t);
+      if (keyed) {
+        gimli_type_collection_intern(file->types, key, t);
+      }
       populate_struct_or_union(t, file, die);
       return t;
 
@@ -2101,6 +3627,13 @@ static gimli_type_t load_type_die(
       break;
 
     case DW_TAG_enumeration_type:
+      keyed = aggregate_key(file, die, type_name, key, sizeof(key));
+      if (keyed) {
+        t = gimli_type_collection_find_interned(file->types, key);
+        if (t) {
+          break;
+        }
+      }
       memset(&enc, 0, sizeof(enc));
       gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_byte_size, &size);
       enc.bits = size * 8;
@@ -2109,6 +3642,9 @@ static gimli_type_t load_type_die(
       if (!populate_enum(t, file, die)) {
         return NULL;
       }
+      if (keyed) {
+        gimli_type_collection_intern(file->types, key, t);
+      }
       break;
 
     case DW_TAG_subroutine_type:
@@ -2116,7 +3652,7 @@ static gimli_type_t load_type_die(
       break;
 
     default:
-      printf("unhandled tag 0x%" PRIx64 " in load_type (%s)\n", die->tag, type_name);
+      printf("unhandled tag 0x%x in load_type (%s)\n", die->tag, type_name);
       return NULL;
   }
 
@@ -2141,12 +3677,10 @@ static gimli_type_t load_type(
   return load_type_die(file, die);
 }
 
-static void load_types_in_die(gimli_mapped_object_t file,
-    struct gimli_dwarf_die *die)
+/* the tags of the DIEs that load_type_die() understands */
+static int is_type_tag(uint64_t tag)
 {
-  struct gimli_dwarf_die *kid;
-
-  switch (die->tag) {
+  switch (tag) {
     case DW_TAG_base_type:
     case DW_TAG_pointer_type:
     case DW_TAG_const_type:
@@ -2158,11 +3692,21 @@ static void load_types_in_die(gimli_mapped_object_t file,
     case DW_TAG_array_type:
     case DW_TAG_enumeration_type:
     case DW_TAG_subroutine_type:
-      load_type_die(file, die);
-      break;
+      return 1;
+  }
+  return 0;
+}
+
+static void load_types_in_die(gimli_mapped_object_t file,
+    struct gimli_dwarf_die *die)
+{
+  struct gimli_dwarf_die *kid;
+
+  if (is_type_tag(die->tag)) {
+    load_type_die(file, die);
   }
 
-  STAILQ_FOREACH(kid, &die->kids, siblings) {
+  GIMLI_DWARF_DIE_FOREACH_KID(kid, die) {
     load_types_in_die(file, kid);
   }
 }
@@ -2193,10 +3737,519 @@ void gimli_dwarf_load_all_types(gimli_mapped_object_t file)
     cuptr = file->debug_info.start + cu->end;
 
     /* now walk the DIEs and map the types */
-    STAILQ_FOREACH(die, &cu->dies, siblings) {
-      load_types_in_die(file, die);
+    if (cu->die) {
+      load_types_in_die(file, cu->die);
+    }
+  }
+}
+
+/* the DIE at offset, in the CU at cu_offset, if it defines the
+ * named type */
+static struct gimli_dwarf_die *type_die_at(gimli_mapped_object_t file,
+  uint64_t cu_offset, uint64_t offset, const char *name)
+{
+  struct gimli_dwarf_cu *cu;
+  struct gimli_dwarf_die *die;
+  struct gimli_dwarf_attr *attr;
+
+  cu = find_cu(file, cu_offset);
+  if (!cu) {
+    cu = load_cu(file, cu_offset);
+  }
+  if (!cu || offset < cu->offset || offset >= cu->end) {
+    return NULL;
+  }
+  die = gimli_dwarf_get_die(file, offset);
+  if (!die || !is_type_tag(die->tag)) {
+    return NULL;
+  }
+  attr = gimli_dwarf_die_get_attr(die, DW_AT_name);
+  if (!attr || strcmp((char*)attr->ptr, name) ||
+      gimli_dwarf_die_get_attr(die, DW_AT_declaration)) {
+    return NULL;
+  }
+  return die;
+}
+
+/* returns the last component of a qualified C++ name, "Foo" for
+ * "ns::Foo", ignoring any "::" within template arguments */
+static const char *unqualified_name(const char *name)
+{
+  const char *p, *last = name;
+  int depth = 0;
+
+  for (p = name; *p; p++) {
+    if (*p == '<') {
+      depth++;
+    } else if (*p == '>' && depth) {
+      depth--;
+    } else if (!depth && p[0] == ':' && p[1] == ':') {
+      last = p + 2;
+      p++;
+    }
+  }
+  return last;
+}
+
+/* the first definition of the named type among the descendants of
+ * die, searched in the same order as gimli_dwarf_load_all_types.  The
+ * name may be qualified, as the names in .gdb_index are */
+static struct gimli_dwarf_die *find_type_kid(struct gimli_dwarf_die *die,
+  const char *name)
+{
+  struct gimli_dwarf_die *kid, *found;
+  struct gimli_dwarf_attr *attr;
+
+  GIMLI_DWARF_DIE_FOREACH_KID(kid, die) {
+    if (is_type_tag(kid->tag)) {
+      attr = gimli_dwarf_die_get_attr(kid, DW_AT_name);
+      if (attr && !strcmp((char*)attr->ptr, name) &&
+          !gimli_dwarf_die_get_attr(kid, DW_AT_declaration)) {
+        return kid;
+      }
+    }
+    found = find_type_kid(kid, name);
+    if (found) {
+      return found;
+    }
+  }
+  return NULL;
+}
+
+/* The .debug_names hash is the DJB hash of the case folded name;
+ * we only fold ASCII, which covers C and C++ identifiers */
+static uint32_t debug_names_hash(const char *name)
+{
+  uint32_t h = 5381;
+
+  while (*name) {
+    h = (h * 33) + tolower((unsigned char)*name++);
+  }
+  return h;
+}
+
+/* Walks the entries for one name in a .debug_names name index,
+ * returning the first that is a definition of the named type */
+static struct gimli_dwarf_die *debug_names_entries(gimli_mapped_object_t file,
+  const uint8_t *data, const uint8_t *end,
+  const uint8_t *abbrevs, const uint8_t *abbrevs_end,
+  const uint8_t *cus, uint32_t cu_count, int is_64,
+  gimli_object_file_t elf, const char *name)
+{
+  struct gimli_dwarf_die *die;
+  const uint8_t *ab, *bytes;
+  uint64_t code, acode, tag, idx, form, val, cu_index, die_offset;
+  int has_die, in_tu;
+
+  while (data < end) {
+    code = dw_read_uleb128(&data, end);
+    if (code == 0) {
+      break;
+    }
+
+    /* locate the abbreviation; these tables are tiny */
+    ab = abbrevs;
+    while (1) {
+      acode = dw_read_uleb128(&ab, abbrevs_end);
+      if (acode == 0) {
+        return NULL;
+      }
+      tag = dw_read_uleb128(&ab, abbrevs_end);
+      if (acode == code) {
+        break;
+      }
+      do {
+        idx = dw_read_uleb128(&ab, abbrevs_end);
+        form = dw_read_uleb128(&ab, abbrevs_end);
+      } while (idx || form);
+    }
+
+    cu_index = 0;
+    die_offset = 0;
+    has_die = 0;
+    in_tu = 0;
+    while (1) {
+      idx = dw_read_uleb128(&ab, abbrevs_end);
+      form = dw_read_uleb128(&ab, abbrevs_end);
+      if (idx == 0 && form == 0) {
+        break;
+      }
+      if (!get_value(form, sizeof(void*), is_64, 5, &data, end,
+            &val, &bytes, elf)) {
+        return NULL;
+      }
+      switch (idx) {
+        case DW_IDX_compile_unit:
+          cu_index = val;
+          break;
+        case DW_IDX_type_unit:
+          in_tu = 1;
+          break;
+        case DW_IDX_die_offset:
+          die_offset = val;
+          has_die = 1;
+          break;
+      }
+    }
+
+    if (in_tu || !has_die || !is_type_tag(tag) || cu_index >= cu_count) {
+      continue;
+    }
+    bytes = cus + (cu_index * (is_64 ? 8 : 4));
+    val = read_offset(&bytes, is_64);
+    die = type_die_at(file, val, val + die_offset, name);
+    if (die) {
+      return die;
+    }
+  }
+  return NULL;
+}
+
+/* Looks up a type using the DWARF 5 accelerated name tables.  Sets
+ * *present if the object has them */
+static struct gimli_dwarf_die *debug_names_lookup(gimli_mapped_object_t file,
+  const char *name, int *present)
+{
+  const uint8_t *data, *end, *next, *cus, *buckets, *hashes, *strs;
+  const uint8_t *entries, *abbrevs, *pool, *ptr;
+  gimli_object_file_t elf = file->debug_info.elf;
+  struct gimli_dwarf_die *die;
+  uint32_t len32, counts[7], hash, bucket, h, i;
+  uint64_t initlen, off;
+  int is_64, off_size;
+  uint16_t ver;
+
+  if (!get_sect_data(file, ".debug_names", &data, &end, &elf)) {
+    return NULL;
+  }
+  *present = 1;
+  hash = debug_names_hash(name);
+
+  /* each name index covers a set of CUs; there is usually one per
+   * CU unless the linker merged them */
+  while (data + sizeof(len32) <= end) {
+    memcpy(&len32, data, sizeof(len32));
+    data += sizeof(len32);
+    if (len32 == 0xffffffff) {
+      is_64 = 1;
+      memcpy(&initlen, data, sizeof(initlen));
+      data += sizeof(initlen);
+    } else {
+      is_64 = 0;
+      initlen = len32;
+    }
+    next = data + initlen;
+    if (next > end) {
+      break;
+    }
+    off_size = is_64 ? 8 : 4;
+
+    memcpy(&ver, data, sizeof(ver));
+    /* version and padding */
+    data += 2 * sizeof(ver);
+    if (ver != 5) {
+      data = next;
+      continue;
+    }
+
+    /* comp_unit_count, local_type_unit_count, foreign_type_unit_count,
+     * bucket_count, name_count, abbrev_table_size and
+     * augmentation_string_size */
+    memcpy(counts, data, sizeof(counts));
+    data += sizeof(counts) + counts[6];
+
+    cus = data;
+    data += (counts[0] + counts[1]) * off_size;
+    data += counts[2] * sizeof(uint64_t);
+    buckets = data;
+    data += counts[3] * sizeof(uint32_t);
+    hashes = data;
+    if (counts[3]) {
+      data += counts[4] * sizeof(uint32_t);
+    }
+    strs = data;
+    data += counts[4] * off_size;
+    entries = data;
+    data += counts[4] * off_size;
+    abbrevs = data;
+    pool = abbrevs + counts[5];
+    if (pool > next) {
+      data = next;
+      continue;
+    }
+
+    /* without a hash table, the names have to be searched in order */
+    i = 1;
+    bucket = 0;
+    if (counts[3]) {
+      bucket = hash % counts[3];
+      memcpy(&i, buckets + (bucket * sizeof(uint32_t)), sizeof(i));
+      if (i == 0) {
+        i = counts[4] + 1;
+      }
+    }
+    for (; i <= counts[4]; i++) {
+      if (counts[3]) {
+        memcpy(&h, hashes + ((i - 1) * sizeof(uint32_t)), sizeof(h));
+        if (h % counts[3] != bucket) {
+          break;
+        }
+        if (h != hash) {
+          continue;
+        }
+      }
+      ptr = strs + ((i - 1) * off_size);
+      off = read_offset(&ptr, is_64);
+      ptr = get_string(".debug_str", off, elf);
+      if (!ptr || strcmp((char*)ptr, name)) {
+        continue;
+      }
+      ptr = entries + ((i - 1) * off_size);
+      off = read_offset(&ptr, is_64);
+      die = debug_names_entries(file, pool + off, next, abbrevs, pool,
+          cus, counts[0], is_64, elf, name);
+      if (die) {
+        return die;
+      }
     }
+    data = next;
+  }
+  return NULL;
+}
+
+/* the name hash used by .gdb_index version 5 and later */
+static uint32_t gdb_index_hash(const char *name)
+{
+  uint32_t r = 0;
+
+  while (*name) {
+    r = (r * 67) + tolower((unsigned char)*name++) - 113;
+  }
+  return r;
+}
+
+/* Looks up a type using the index that gdb-add-index (or the linker)
+ * adds to an object.  It only names the CU that holds the type, so
+ * that CU is searched for the definition.  Sets *present if the
+ * object has a usable index */
+static struct gimli_dwarf_die *gdb_index_lookup(gimli_mapped_object_t file,
+  const char *name, int *present)
+{
+  const uint8_t *data, *end, *symtab, *pool, *vec;
+  gimli_object_file_t elf = NULL;
+  struct gimli_dwarf_cu *cu;
+  struct gimli_dwarf_die *die;
+  uint32_t hdr[7], ncus, size, hash, slot, step, name_off, vec_off;
+  uint32_t count, cuv, i;
+  uint64_t cu_offset;
+
+  if (!get_sect_data(file, ".gdb_index", &data, &end, &elf) ||
+      end - data < sizeof(hdr)) {
+    return NULL;
+  }
+  /* version, then the offsets of the CU list, TU list, address
+   * area, symbol table, (v9) shortcut table and constant pool */
+  memcpy(hdr, data, sizeof(hdr));
+  if (hdr[0] < 7 || hdr[0] > 9) {
+    return NULL;
+  }
+  pool = data + hdr[hdr[0] >= 9 ? 6 : 5];
+  if (pool >= end) {
+    return NULL;
+  }
+  *present = 1;
+
+  ncus = (hdr[2] - hdr[1]) / (2 * sizeof(uint64_t));
+  symtab = data + hdr[4];
+  size = (hdr[5] - hdr[4]) / (2 * sizeof(uint32_t));
+  if (size == 0) {
+    return NULL;
+  }
+
+  /* open addressed; the size is a power of two */
+  hash = gdb_index_hash(name);
+  slot = hash & (size - 1);
+  step = ((hash * 17) & (size - 1)) | 1;
+  for (i = 0; i < size; i++) {
+    memcpy(&name_off, symtab + (slot * 2 * sizeof(uint32_t)),
+        sizeof(name_off));
+    memcpy(&vec_off, symtab + (slot * 2 * sizeof(uint32_t)) +
+        sizeof(uint32_t), sizeof(vec_off));
+    if (name_off == 0 && vec_off == 0) {
+      break;
+    }
+    if (pool + name_off < end && !strcmp((char*)pool + name_off, name)) {
+      break;
+    }
+    slot = (slot + step) & (size - 1);
+  }
+  if (i == size || (name_off == 0 && vec_off == 0)) {
+    return NULL;
+  }
+
+  vec = pool + vec_off;
+  memcpy(&count, vec, sizeof(count));
+  for (i = 0; i < count; i++) {
+    memcpy(&cuv, vec + ((i + 1) * sizeof(uint32_t)), sizeof(cuv));
+    /* symbol kind 1 is a type; CU indices past the CU list refer to
+     * type units */
+    if (((cuv >> 28) & 7) != 1 || (cuv & 0xffffff) >= ncus) {
+      continue;
+    }
+    memcpy(&cu_offset, data + hdr[1] +
+        ((cuv & 0xffffff) * 2 * sizeof(uint64_t)), sizeof(cu_offset));
+    cu = find_cu(file, cu_offset);
+    if (!cu) {
+      cu = load_cu(file, cu_offset);
+    }
+    if (cu && cu->die) {
+      die = find_type_kid(cu->die, unqualified_name(name));
+      if (die) {
+        return die;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Returns the set of CU offsets listed by the name indices in
+ * .debug_names, or NULL if it has none.  A linker that doesn't merge
+ * them just concatenates the indices of the objects that had one, so
+ * CUs from other objects may be missing */
+static gimli_hash_t debug_names_cus(gimli_mapped_object_t file)
+{
+  const uint8_t *data, *end, *next, *ptr;
+  gimli_object_file_t elf = file->debug_info.elf;
+  gimli_hash_t cus;
+  uint32_t len32, cu_count, i;
+  uint64_t initlen;
+  int is_64;
+
+  if (!get_sect_data(file, ".debug_names", &data, &end, &elf)) {
+    return NULL;
+  }
+  cus = gimli_hash_new_size(NULL, GIMLI_HASH_U64_KEYS, 0);
+
+  while (data + sizeof(len32) <= end) {
+    memcpy(&len32, data, sizeof(len32));
+    data += sizeof(len32);
+    if (len32 == 0xffffffff) {
+      is_64 = 1;
+      memcpy(&initlen, data, sizeof(initlen));
+      data += sizeof(initlen);
+    } else {
+      is_64 = 0;
+      initlen = len32;
+    }
+    next = data + initlen;
+    if (next > end) {
+      break;
+    }
+
+    /* version, padding, then comp_unit_count; the CU list follows
+     * the remaining counts and the augmentation string */
+    memcpy(&cu_count, data + 4, sizeof(cu_count));
+    memcpy(&len32, data + 28, sizeof(len32));
+    ptr = data + 32 + len32;
+    for (i = 0; i < cu_count && ptr < next; i++) {
+      gimli_hash_insert_u64(cus, read_offset(&ptr, is_64), NULL);
+    }
+    data = next;
+  }
+  return cus;
+}
+
+/* record the type definitions found anywhere beneath die, including
+ * those in namespaces and nested within structs and functions, just
+ * as gimli_dwarf_load_all_types would find them */
+static void index_type_names(gimli_hash_t idx, struct gimli_dwarf_die *die)
+{
+  struct gimli_dwarf_die *kid;
+  struct gimli_dwarf_attr *attr;
+
+  GIMLI_DWARF_DIE_FOREACH_KID(kid, die) {
+    if (is_type_tag(kid->tag)) {
+      attr = gimli_dwarf_die_get_attr(kid, DW_AT_name);
+      if (attr && !gimli_dwarf_die_get_attr(kid, DW_AT_declaration)) {
+        /* the first definition wins */
+        gimli_hash_insert(idx, (char*)attr->ptr, kid);
+      }
+    }
+    index_type_names(idx, kid);
+  }
+}
+
+/* Index the type names of the CUs that .debug_names doesn't cover;
+ * that's all of them when it isn't present.  This decodes the DIEs,
+ * but none of the types themselves */
+static void build_type_index(gimli_mapped_object_t file)
+{
+  struct gimli_dwarf_cu *cu;
+  const uint8_t *cuptr, *next;
+  gimli_hash_t covered;
+  uint64_t off;
+
+  file->type_index_built = 1;
+  covered = debug_names_cus(file);
+
+  for (cuptr = file->debug_info.start;
+      (next = skip_unit(cuptr, file->debug_info.end)) != NULL;
+      cuptr = next) {
+    off = cuptr - file->debug_info.start;
+
+    if (covered && gimli_hash_find_u64(covered, off, NULL)) {
+      continue;
+    }
+    cu = find_cu(file, off);
+    if (!cu) {
+      cu = load_cu(file, off);
+    }
+    if (cu && cu->die) {
+      index_type_names(file->type_index, cu->die);
+    }
+  }
+
+  if (covered) {
+    gimli_hash_destroy(covered);
+  }
+}
+
+/* Load the named type from file, decoding only the CU that defines
+ * it where the object carries .debug_names or .gdb_index */
+gimli_type_t gimli_dwarf_load_type_by_name(gimli_mapped_object_t file,
+  const char *name)
+{
+  struct gimli_dwarf_die *die = NULL;
+  int present = 0;
+
+  if (!init_debug_info(file)) {
+    return NULL;
+  }
+  if (!file->type_index) {
+    file->type_index = gimli_hash_new(NULL);
+  }
+
+  if (!gimli_hash_find(file->type_index, name, (void**)&die)) {
+    die = debug_names_lookup(file, name, &present);
+    if (!die && !present) {
+      /* .gdb_index holds qualified names, so a type that is only
+       * known by its unqualified name, or one nested in a struct or
+       * function, may be missing from it; fall back to our own index */
+      die = gdb_index_lookup(file, name, &present);
+    }
+    if (!die && !file->type_index_built) {
+      build_type_index(file);
+      gimli_hash_find(file->type_index, name, (void**)&die);
+    }
+    if (die) {
+      gimli_hash_insert(file->type_index, name, die);
+    }
+  }
+  if (!die) {
+    return NULL;
   }
+
+  return load_type_die(file, die);
 }
 
 /* Locate the DIE for a data address and load its type
@@ -2247,8 +4300,9 @@ static void load_var(
   if (location) {
     switch (location->form) {
       case DW_FORM_block:
-        if (!dw_eval_expr(&frame->cur, (uint8_t*)location->ptr, location->code,
-              frame_base, &res, NULL, &is_stack)) {
+        if (!dw_eval_compiled(&frame->cur,
+              dw_compile_expr(m->objfile, (uint8_t*)location->ptr,
+                location->code), frame_base, &res, &is_stack)) {
           res = 0;
         }
         break;
@@ -2258,8 +4312,14 @@ static void load_var(
           res = 0;
         }
         break;
+      case DW_FORM_sec_offset:
+        if (!dw_calc_loclist(&frame->cur, comp_unit_base, m,
+              location, &res, &is_stack)) {
+          res = 0;
+        }
+        break;
       default:
-        printf("Unhandled location form 0x%" PRIx64 "\n", location->form);
+        printf("Unhandled location form 0x%x\n", location->form);
     }
   } else if (name) {
     /* no location defined, so assume the compiler optimized it away */
@@ -2268,7 +4328,11 @@ static void load_var(
     return;
   }
 
-  var = calloc(1, sizeof(*var));
+  var = gimli_slab_alloc(&frame->trace->varslab);
+  if (!var) {
+    return;
+  }
+  memset(var, 0, sizeof(*var));
   var->varname = name ? (char*)name->ptr : NULL;
   var->addr = res;
   var->proc = frame->cur.proc;
@@ -2282,28 +4346,36 @@ static void load_var(
 /* load DWARF DIEs to collect information about variables */
 int gimli_dwarf_load_frame_var_info(gimli_stack_frame_t frame)
 {
-  struct gimli_dwarf_die *die, *kid;
+  struct gimli_dwarf_die *die, *kid, *scope, **chain;
   uint64_t frame_base = 0;
   uint64_t comp_unit_base = 0;
   struct gimli_dwarf_attr *frame_base_attr;
   struct gimli_object_mapping *m;
   gimli_proc_t proc = frame->cur.proc;
   gimli_addr_t pc = (gimli_addr_t)frame->cur.st.pc;
+  int depth, i;
 
   if (frame->loaded_vars) return 1;
   frame->loaded_vars = 1;
 
-  die = gimli_dwarf_get_die_for_pc(proc, pc);
+  /* the scope chain runs from the innermost block out to the
+   * subprogram that holds the frame base */
+  scope = find_scope_for_pc(proc, pc);
+  depth = 0;
+  for (die = scope; die; die = die->parent) {
+    depth++;
+    if (die->tag == DW_TAG_subprogram) {
+      break;
+    }
+  }
   if (!die) {
 //    printf("no DIE for pc=" PTRFMT "\n", pc);
     return 0;
   }
   m = gimli_mapping_for_addr(proc, pc);
 
-  if (die->parent->tag == DW_TAG_compile_unit) {
-    gimli_dwarf_die_get_uint64_t_attr(die->parent,
+  gimli_dwarf_die_get_uint64_t_attr(die->cu->die,
       DW_AT_low_pc, &comp_unit_base);
-  }
 
   frame_base_attr = gimli_dwarf_die_get_attr(die, DW_AT_frame_base);
   if (frame_base_attr) {
@@ -2311,25 +4383,44 @@ int gimli_dwarf_load_frame_var_info(gimli_stack_frame_t frame)
 
     switch (frame_base_attr->form) {
       case DW_FORM_block:
-        dw_eval_expr(&frame->cur, (uint8_t*)frame_base_attr->ptr, frame_base_attr->code,
-            0, &frame_base, NULL, &is_stack);
+        dw_eval_compiled(&frame->cur,
+            dw_compile_expr(m->objfile, (uint8_t*)frame_base_attr->ptr,
+              frame_base_attr->code), 0, &frame_base, &is_stack);
         break;
       case DW_FORM_data8:
         dw_calc_location(&frame->cur, comp_unit_base, m,
             frame_base_attr->code, &frame_base, NULL, &is_stack);
         break;
+      case DW_FORM_sec_offset:
+        dw_calc_loclist(&frame->cur, comp_unit_base, m,
+            frame_base_attr, &frame_base, &is_stack);
+        break;
       default:
-        printf("Unhandled frame base form 0x%" PRIx64 "\n",
+        printf("Unhandled frame base form 0x%x\n",
             frame_base_attr->form);
         return 0;
     }
   }
 
-  STAILQ_FOREACH(kid, &die->kids, siblings) {
-    if (kid->tag == DW_TAG_formal_parameter || kid->tag == DW_TAG_variable) {
-      load_var(frame, kid, frame_base, comp_unit_base, m);
+  chain = malloc(depth * sizeof(*chain));
+  for (i = depth - 1, die = scope; i >= 0; i--, die = die->parent) {
+    chain[i] = die;
+  }
+
+  /* collect the variables from the outermost scope inwards; the
+   * variables of an inlined subroutine and the blocks within it
+   * belong to the inlined function rather than this frame */
+  for (i = 0; i < depth; i++) {
+    if (chain[i]->tag == DW_TAG_inlined_subroutine) {
+      break;
+    }
+    GIMLI_DWARF_DIE_FOREACH_KID(kid, chain[i]) {
+      if (kid->tag == DW_TAG_formal_parameter || kid->tag == DW_TAG_variable) {
+        load_var(frame, kid, frame_base, comp_unit_base, m);
+      }
     }
   }
+  free(chain);
 
   return 1;
 }
@@ -900,6 +900,7 @@ static struct dw_fde *find_fde(gimli_proc_t proc, gimli_addr_t pc)
 int gimli_dwarf_unwind_next(struct gimli_unwind_cursor *cur)
 {
   struct dw_fde *fde;
+  int ok;
 
   /* can't unwind via dwarf if don't have a valid register set */
   if (cur->dwarffail) {
@@ -954,7 +955,10 @@ int gimli_dwarf_unwind_next(struct gimli_unwind_cursor *cur)
     return 0;
   }
   /* map the regs back into the cursor */
-  if (!apply_regs(cur, fde->cie)) {
+  ok = apply_regs(cur, fde->cie);
+  /* the cursor now describes the caller, whose CFA is different */
+  cur->have_cfa = 0;
+  if (!ok) {
     if (debug) {
       fprintf(stderr,
           "DWARF: unwind: failed to apply unwind rules\n");
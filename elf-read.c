@@ -180,7 +180,7 @@ struct gimli_section_data *gimli_get_section_by_name(
   data->size = shdr->sh_size;
   data->offset = shdr->sh_offset;
   data->addr = shdr->sh_addr;
-  data->name = strdup(name);
+  data->name = gimli_intern(name);
   data->container = elf;
   gimli_hash_insert(elf->gobject->sections, name, data);
   return data;
@@ -212,7 +212,6 @@ void gimli_object_file_destroy(struct gimli_elf_ehdr *elf)
   if (elf->fd >= 0) {
     close(elf->fd);
   }
-  free(elf->objname);
   free(elf);
 }
 
@@ -240,7 +239,7 @@ closeout:
     return 0;
   }
 
-  elf->objname = strdup(filename);
+  elf->objname = gimli_intern(filename);
 
   if (ident[GIMLI_EI_VERSION] != GIMLI_EV_CURRENT) {
     fprintf(stderr, "ELF: %s: unsupported ELF version %d\n", filename,
@@ -443,6 +442,195 @@ closeout:
   return elf;
 }
 
+static void decode_symbol(struct gimli_elf_ehdr *elf, const char *symtab,
+  struct gimli_elf_symbol *sym)
+{
+  memset(sym, 0, sizeof(*sym));
+  if (elf->ei_class == GIMLI_ELFCLASS32) {
+    struct elf32_sym s;
+
+    memcpy(&s, symtab, sizeof(s));
+    sym->st_name = s.st_name;
+    sym->st_value = s.st_value;
+    sym->st_size = s.st_size;
+    sym->st_info = s.st_info;
+    sym->st_other = s.st_other;
+    sym->st_shndx = s.st_shndx;
+  } else {
+    struct elf64_sym s;
+
+    memcpy(&s, symtab, sizeof(s));
+    sym->st_name = s.st_name;
+    sym->st_value = s.st_value;
+    sym->st_size = s.st_size;
+    sym->st_info = s.st_info;
+    sym->st_other = s.st_other;
+    sym->st_shndx = s.st_shndx;
+  }
+}
+
+/* the hash function used by DT_GNU_HASH */
+static uint32_t gnu_hash(const char *name)
+{
+  const unsigned char *c = (const unsigned char*)name;
+  uint32_t h = 5381;
+
+  while (*c) {
+    h = (h << 5) + h + *c++;
+  }
+  return h;
+}
+
+/* the hash function used by DT_HASH */
+static uint32_t sysv_hash(const char *name)
+{
+  const unsigned char *c = (const unsigned char*)name;
+  uint32_t h = 0, g;
+
+  while (*c) {
+    h = (h << 4) + *c++;
+    g = h & 0xf0000000;
+    if (g) {
+      h ^= g >> 24;
+    }
+    h &= ~g;
+  }
+  return h;
+}
+
+/* Decodes the dynsym entry at index symix and returns 1 if it
+ * is a definition of name */
+static int match_dynsym(struct gimli_elf_ehdr *elf,
+  struct gimli_elf_shdr *dynsym, const char *symtab, const char *strtab,
+  uint32_t symix, const char *name, struct gimli_elf_symbol *sym)
+{
+  if ((uint64_t)(symix + 1) * dynsym->sh_entsize > dynsym->sh_size) {
+    return 0;
+  }
+  decode_symbol(elf, symtab + (symix * dynsym->sh_entsize), sym);
+  if (sym->st_shndx == GIMLI_SHN_UNDEF) {
+    return 0;
+  }
+  sym->name = (char*)strtab + sym->st_name;
+  return strcmp(sym->name, name) == 0;
+}
+
+/* Look up an exported symbol by name using the .gnu.hash or .hash
+ * table of the object, rather than walking the complete symbol table.
+ * Returns 1 and populates sym if name is defined in the dynamic
+ * symbol table, 0 otherwise */
+int gimli_elf_lookup_dynsym(struct gimli_elf_ehdr *elf,
+  const char *name, struct gimli_elf_symbol *sym)
+{
+  struct gimli_elf_shdr *s, *hashsec = NULL, *dynsym, *dynstr;
+  const uint32_t *words;
+  const char *symtab, *strtab;
+  uint32_t h, symix;
+
+  STAILQ_FOREACH(s, &elf->sections, shdrs) {
+    if (s->sh_type == GIMLI_SHT_GNU_HASH) {
+      hashsec = s;
+      break;
+    }
+    if (s->sh_type == GIMLI_SHT_HASH && !hashsec) {
+      hashsec = s;
+    }
+  }
+  if (!hashsec) {
+    return 0;
+  }
+  dynsym = gimli_get_section_by_index(elf, hashsec->sh_link);
+  if (!dynsym || !dynsym->sh_entsize) {
+    return 0;
+  }
+  dynstr = gimli_get_section_by_index(elf, dynsym->sh_link);
+  if (!dynstr) {
+    return 0;
+  }
+  words = (const uint32_t*)gimli_get_section_data(elf, hashsec->section_no);
+  symtab = gimli_get_section_data(elf, dynsym->section_no);
+  strtab = gimli_get_section_data(elf, dynstr->section_no);
+  if (!words || !symtab || !strtab || hashsec->sh_size < 16) {
+    return 0;
+  }
+
+  if (hashsec->sh_type == GIMLI_SHT_GNU_HASH) {
+    uint32_t nbuckets = words[0];
+    uint32_t symoffset = words[1];
+    uint32_t bloom_size = words[2];
+    uint32_t bloom_shift = words[3];
+    uint32_t bits = elf->ei_class == GIMLI_ELFCLASS32 ? 32 : 64;
+    uint32_t bloom_words = bloom_size * (bits / 32);
+    const uint32_t *buckets, *chain;
+    uint64_t word, mask;
+
+    if (!nbuckets || !bloom_size ||
+        (4 + bloom_words + nbuckets) * 4 > hashsec->sh_size) {
+      return 0;
+    }
+
+    h = gnu_hash(name);
+
+    /* the bloom filter lets us reject most misses cheaply */
+    if (bits == 32) {
+      word = words[4 + ((h / bits) % bloom_size)];
+    } else {
+      memcpy(&word, words + 4 + (((h / bits) % bloom_size) * 2),
+          sizeof(word));
+    }
+    mask = (UINT64_C(1) << (h % bits)) |
+      (UINT64_C(1) << ((h >> bloom_shift) % bits));
+    if ((word & mask) != mask) {
+      return 0;
+    }
+
+    buckets = words + 4 + bloom_words;
+    chain = buckets + nbuckets;
+
+    symix = buckets[h % nbuckets];
+    if (symix < symoffset) {
+      return 0;
+    }
+    for (;; symix++) {
+      uint32_t h2;
+
+      if ((const char*)(chain + (symix - symoffset) + 1) >
+          (const char*)words + hashsec->sh_size) {
+        return 0;
+      }
+      h2 = chain[symix - symoffset];
+      if ((h | 1) == (h2 | 1) &&
+          match_dynsym(elf, dynsym, symtab, strtab, symix, name, sym)) {
+        return 1;
+      }
+      if (h2 & 1) {
+        /* end of the chain */
+        return 0;
+      }
+    }
+  }
+
+  /* DT_HASH */
+  {
+    uint32_t nbucket = words[0];
+    uint32_t nchain = words[1];
+    const uint32_t *bucket = words + 2;
+    const uint32_t *chain = bucket + nbucket;
+
+    if (!nbucket || (2 + nbucket + nchain) * 4 > hashsec->sh_size) {
+      return 0;
+    }
+    h = sysv_hash(name);
+    for (symix = bucket[h % nbucket]; symix && symix < nchain;
+        symix = chain[symix]) {
+      if (match_dynsym(elf, dynsym, symtab, strtab, symix, name, sym)) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
 int gimli_elf_enum_symbols(struct gimli_elf_ehdr *elf,
   gimli_elf_sym_iter_func func, void *arg)
 {
@@ -463,28 +651,7 @@ int gimli_elf_enum_symbols(struct gimli_elf_ehdr *elf,
       for (; symtab < end; symtab += s->sh_entsize) {
         struct gimli_elf_symbol sym;
 
-        memset(&sym, 0, sizeof(sym));
-        if (elf->ei_class == GIMLI_ELFCLASS32) {
-          struct elf32_sym s;
-
-          memcpy(&s, symtab, sizeof(s));
-          sym.st_name = s.st_name;
-          sym.st_value = s.st_value;
-          sym.st_size = s.st_size;
-          sym.st_info = s.st_info;
-          sym.st_other = s.st_other;
-          sym.st_shndx = s.st_shndx;
-        } else {
-          struct elf64_sym s;
-
-          memcpy(&s, symtab, sizeof(s));
-          sym.st_name = s.st_name;
-          sym.st_value = s.st_value;
-          sym.st_size = s.st_size;
-          sym.st_info = s.st_info;
-          sym.st_other = s.st_other;
-          sym.st_shndx = s.st_shndx;
-        }
+        decode_symbol(elf, symtab, &sym);
         if (sym.st_shndx == GIMLI_SHN_UNDEF) {
           continue;
         }
@@ -45,16 +45,27 @@ int gimli_process_elf(gimli_mapped_object_t f)
   }
 #endif
 
-  gimli_elf_enum_symbols(f->elf, for_each_symbol, f);
-
   if (f->aux_elf) {
     f->aux_elf->gobject = f;
-    gimli_elf_enum_symbols(f->aux_elf, for_each_symbol, f);
   }
 
   return 1;
 }
 
+/* Adds the symbols of the object and of its debug file, if any.
+ * The full symbol tables are large and most objects are only ever
+ * asked about a handful of names, so this is deferred until the
+ * symtab is first baked */
+void gimli_elf_load_symbols(gimli_mapped_object_t f)
+{
+  if (f->elf) {
+    gimli_elf_enum_symbols(f->elf, for_each_symbol, f);
+  }
+  if (f->aux_elf) {
+    gimli_elf_enum_symbols(f->aux_elf, for_each_symbol, f);
+  }
+}
+
 #endif
 
 /* vim:ts=2:sw=2:et:
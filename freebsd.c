@@ -206,6 +206,7 @@ static void read_maps(gimli_proc_t proc)
   map.pve_path = path;
   map.pve_pathlen = sizeof(path);
 
+  proc->defer_loads = 1;
   while (ptrace(PT_VM_ENTRY, proc->pid, (caddr_t)&map, 0) == 0) {
     gimli_add_mapping(proc, map.pve_path, (void*)map.pve_start,
       map.pve_end, map.pve_offset);
@@ -213,6 +214,7 @@ static void read_maps(gimli_proc_t proc)
     /* reset for next iteration */
     map.pve_pathlen = sizeof(path);
   }
+  gimli_load_pending_objects(proc);
 }
 
 static child_stopped = 0;
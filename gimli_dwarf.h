@@ -99,6 +99,51 @@ extern "C" {
 #define DW_LNE_set_address 0x02
 #define DW_LNE_define_file 0x03
 
+/* DWARF 5 line number header entry formats */
+#define DW_LNCT_path 0x1
+#define DW_LNCT_directory_index 0x2
+#define DW_LNCT_timestamp 0x3
+#define DW_LNCT_size 0x4
+#define DW_LNCT_MD5 0x5
+
+/* DWARF 5 unit header types */
+#define DW_UT_compile 0x01
+#define DW_UT_type 0x02
+#define DW_UT_partial 0x03
+#define DW_UT_skeleton 0x04
+#define DW_UT_split_compile 0x05
+#define DW_UT_split_type 0x06
+
+/* DWARF 5 .debug_rnglists entries */
+#define DW_RLE_end_of_list 0x00
+#define DW_RLE_base_addressx 0x01
+#define DW_RLE_startx_endx 0x02
+#define DW_RLE_startx_length 0x03
+#define DW_RLE_offset_pair 0x04
+#define DW_RLE_base_address 0x05
+#define DW_RLE_start_end 0x06
+#define DW_RLE_start_length 0x07
+
+/* DWARF 5 .debug_loclists entries */
+#define DW_LLE_end_of_list 0x00
+#define DW_LLE_base_addressx 0x01
+#define DW_LLE_startx_endx 0x02
+#define DW_LLE_startx_length 0x03
+#define DW_LLE_offset_pair 0x04
+#define DW_LLE_default_location 0x05
+#define DW_LLE_base_address 0x06
+#define DW_LLE_start_end 0x07
+#define DW_LLE_start_length 0x08
+/* GNU extension; a pair of location view numbers */
+#define DW_LLE_GNU_view_pair 0x09
+
+/* DWARF 5 .debug_names index attributes */
+#define DW_IDX_compile_unit 0x01
+#define DW_IDX_type_unit 0x02
+#define DW_IDX_die_offset 0x03
+#define DW_IDX_parent 0x04
+#define DW_IDX_type_hash 0x05
+
 #define DW_CHILDREN_no  0x00
 #define DW_CHILDREN_yes 0x01
 
@@ -160,6 +205,10 @@ extern "C" {
 #define DW_TAG_imported_unit 0x3d
 #define DW_TAG_condition 0x3f
 #define DW_TAG_shared_type 0x40
+/* DWARF 4 */
+#define DW_TAG_type_unit 0x41
+/* DWARF 5 */
+#define DW_TAG_skeleton_unit 0x4a
 #define DW_TAG_lo_user 0x4080
 #define DW_TAG_hi_user 0xffff
 
@@ -250,6 +299,13 @@ extern "C" {
 #define DW_AT_elemental 0x66 // flag
 #define DW_AT_pure 0x67 // flag
 #define DW_AT_recursive 0x68 // flag
+/* DWARF 4 */
+#define DW_AT_data_bit_offset 0x6b // constant
+/* DWARF 5 */
+#define DW_AT_str_offsets_base 0x72 // stroffsetsptr
+#define DW_AT_addr_base 0x73 // addrptr
+#define DW_AT_rnglists_base 0x74 // rnglistsptr
+#define DW_AT_loclists_base 0x8c // loclistsptr
 #define DW_AT_lo_user 0x2000 // ---
 #define DW_AT_hi_user 0x3fff // ---
 #define DW_FORM_addr 0x01 // address
@@ -280,6 +336,26 @@ extern "C" {
 #define DW_FORM_flag_present 0x19
 #define DW_FORM_ref_sig8     0x20
 
+/* DWARF 5 */
+#define DW_FORM_strx           0x1a
+#define DW_FORM_addrx          0x1b
+#define DW_FORM_ref_sup4       0x1c
+#define DW_FORM_strp_sup       0x1d
+#define DW_FORM_data16         0x1e
+#define DW_FORM_line_strp      0x1f
+#define DW_FORM_implicit_const 0x21
+#define DW_FORM_loclistx       0x22
+#define DW_FORM_rnglistx       0x23
+#define DW_FORM_ref_sup8       0x24
+#define DW_FORM_strx1          0x25
+#define DW_FORM_strx2          0x26
+#define DW_FORM_strx3          0x27
+#define DW_FORM_strx4          0x28
+#define DW_FORM_addrx1         0x29
+#define DW_FORM_addrx2         0x2a
+#define DW_FORM_addrx3         0x2b
+#define DW_FORM_addrx4         0x2c
+
 /* operation, code, no. operands, notes */
 #define DW_OP_addr 0x03 // 1 constant address  (size target specific)
 #define DW_OP_deref 0x06 // 0
@@ -369,6 +445,9 @@ extern "C" {
 #define DW_OP_implicit_value 0x9e // uleb128 size encoded value here
 #define DW_OP_stack_value 0x9f // result is on the expr stack
 
+// DWARF 5
+#define DW_OP_addrx 0xa1 // uleb128 index into .debug_addr
+
 // GNU extensions
 #define DW_OP_GNU_entry_value 0xf3
 
@@ -391,33 +470,108 @@ extern "C" {
 #define DW_ATE_lo_user 0x80
 #define DW_ATE_hi_user 0xff
 
+/* attribute and form codes are defined to fit in 16 bits */
 struct gimli_dwarf_attr {
-  struct gimli_dwarf_attr *next;
-  uint64_t attr;
-  uint64_t form;
+  uint16_t attr;
+  uint16_t form;
   uint64_t code;
   const uint8_t *ptr;
 };
 
+/* an abbreviation, decoded from .debug_abbrev */
+struct gimli_dwarf_abbr_attr {
+  uint16_t attr;
+  uint16_t form;
+  /** encoded size of the value, or -1 if it is variable length */
+  int32_t size;
+  int64_t implicit_const;
+};
+
+struct gimli_dwarf_abbr {
+  uint64_t code;
+  uint16_t tag;
+  uint8_t has_children;
+  uint16_t nattrs;
+  /** total size of the attribute values, or -1 if any of them are
+   * variable length or are a DW_AT_sibling that should be read */
+  int32_t fixed_size;
+  struct gimli_dwarf_abbr_attr *attrs;
+};
+
+/* the abbreviation table at a .debug_abbrev offset.  The sizes in it
+ * depend on the unit header, so units with different address or
+ * offset sizes get their own copy */
+struct gimli_dwarf_abbr_table {
+  /** sorted by code; when dense, abbrs[i].code == i + 1 */
+  struct gimli_dwarf_abbr *abbrs;
+  uint32_t nabbrs;
+  uint8_t dense;
+};
+
+/* an address range covered by a subprogram, lexical block or
+ * inlined subroutine; see build_scope_index */
+struct gimli_dwarf_scope {
+  uint64_t lo, hi;
+  struct gimli_dwarf_die *die;
+  /** index of the closest enclosing range, or -1 */
+  int32_t parent;
+  uint32_t depth;
+};
+
 /* compilation unit */
 struct gimli_dwarf_cu {
   /** offset of CU within .debug_info */
   uint64_t offset, end;
   /** offset into abbrev */
   uint64_t da_offset;
+  /** unit header details */
+  uint16_t version;
+  uint8_t addr_size;
+  uint8_t is_64;
+  /** DWARF 5 section bases, taken from the unit DIE.  Attributes
+   * using the indexed forms (strx, addrx, loclistx, rnglistx) keep
+   * their index and a pointer to the CU until they are looked up */
+  uint64_t str_offsets_base, addr_base, rnglists_base, loclists_base;
+  gimli_mapped_object_t file;
+  struct gimli_dwarf_abbr_table *abbrs;
   struct gimli_dwarf_cu *left, *right;
-  STAILQ_HEAD(cudielist, gimli_dwarf_die) dies;
+  /** the unit DIE */
+  struct gimli_dwarf_die *die;
+  /** .debug_info offset => DIE, for the DIEs recorded so far */
+  struct libgimli_hash_table *die_by_offset;
+  /** code ranges sorted by address, built on first use */
+  struct gimli_dwarf_scope *scopes;
+  uint32_t nscopes;
+  uint8_t scopes_built;
 };
 
+/* DIEs are materialized lazily; the attrs and kids arrays are
+ * only valid after gimli_dwarf_die_get_attr() and
+ * gimli_dwarf_die_kids() respectively.  The children of a DIE are
+ * stored contiguously, as are its attributes, which are held in the
+ * order that its abbreviation lists them */
 struct gimli_dwarf_die {
   uint64_t offset;
-  uint64_t tag;
-  STAILQ_ENTRY(gimli_dwarf_die) siblings;
-  STAILQ_HEAD(dielist, gimli_dwarf_die) kids;
+  /** offset just past this DIE and all of its children */
+  uint64_t end;
   struct gimli_dwarf_die *parent;
+  struct gimli_dwarf_die *kids;
   struct gimli_dwarf_attr *attrs;
+  struct gimli_dwarf_cu *cu;
+  struct gimli_dwarf_abbr *abbr;
+  uint32_t nkids;
+  uint16_t tag;
+  uint16_t nattrs;
+  uint8_t has_children;
+  uint8_t attrs_loaded;
+  uint8_t kids_loaded;
 };
 
+/* iterate the children of a DIE, recording them if needed */
+#define GIMLI_DWARF_DIE_FOREACH_KID(kid, die) \
+  for ((kid) = gimli_dwarf_die_kids(die); \
+      (kid) && (kid) < (die)->kids + (die)->nkids; (kid)++)
+
 #ifdef __cplusplus
 }
 #endif
@@ -60,7 +60,7 @@ struct gimli_elf_ehdr {
     ;
   STAILQ_HEAD(sections, gimli_elf_shdr) sections;
   struct gimli_elf_ehdr *refelf;
-  char *objname;
+  const char *objname;
   gimli_mapped_object_t gobject;
   uint64_t vaddr;
 };
@@ -71,6 +71,8 @@ typedef int (*gimli_elf_sym_iter_func)(struct gimli_elf_ehdr *elf,
 int gimli_elf_enum_symbols(struct gimli_elf_ehdr *elf,
   gimli_elf_sym_iter_func func, void *arg);
 struct gimli_elf_ehdr *gimli_elf_open(const char *filename);
+int gimli_elf_lookup_dynsym(struct gimli_elf_ehdr *elf,
+  const char *name, struct gimli_elf_symbol *sym);
 #if 0
 struct gimli_elf_shdr *gimli_get_elf_section_by_name(gimli_object_file_t *elf,
   const char *name);
@@ -126,9 +128,11 @@ const char *gimli_get_section_data(gimli_object_file_t *elf, int section);
 #define GIMLI_SHT_PROGBITS 1
 #define GIMLI_SHT_SYMTAB   2
 #define GIMLI_SHT_STRTAB   3
+#define GIMLI_SHT_HASH     5
 #define GIMLI_SHT_DYNAMIC  6
 #define GIMLI_SHT_NOBITS   8
 #define GIMLI_SHT_DYNSYM   11
+#define GIMLI_SHT_GNU_HASH 0x6ffffff6
 
 #define GIMLI_STB_LOCAL  0
 #define GIMLI_STB_GLOBAL 1
@@ -29,7 +29,7 @@ typedef struct section gimli_section;
 #endif
 
 struct gimli_macho_object {
-  char *objname;
+  const char *objname;
   gimli_mapped_object_t gobject;
   int is_exec;
 };
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2012 Message Systems, Inc. All rights reserved
+ * For licensing information, see:
+ * https://bitbucket.org/wez/gimli/src/tip/LICENSE
+ */
+#include "impl.h"
+
+/* Exercises gimli_hash while a large table is being resized
+ * incrementally, which is when items live in two tables at once */
+
+/* enough keys to push a table of 16384 slots past its load limit */
+#define NKEYS 14400
+
+static int dtor_calls;
+static int failures;
+
+static void count_dtor(void *item)
+{
+  dtor_calls++;
+}
+
+#define CHECK(cond, ...) do { \
+  if (!(cond)) { \
+    printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+    printf(__VA_ARGS__); \
+    printf("\n"); \
+    failures++; \
+  } \
+} while (0)
+
+static void test_u64(void)
+{
+  gimli_hash_t h = gimli_hash_new_size(count_dtor, GIMLI_HASH_U64_KEYS, 0);
+  uint64_t i;
+  void *item;
+
+  dtor_calls = 0;
+  for (i = 1; i <= NKEYS; i++) {
+    CHECK(gimli_hash_insert_u64(h, i, (void*)(uintptr_t)i),
+        "insert %" PRIu64, i);
+  }
+  CHECK(gimli_hash_size(h) == NKEYS, "size %d", gimli_hash_size(h));
+
+  /* each key may only be deleted once, and then can't be found */
+  for (i = 1; i <= 20; i++) {
+    CHECK(gimli_hash_delete_u64(h, i), "delete %" PRIu64, i);
+    CHECK(!gimli_hash_delete_u64(h, i), "second delete %" PRIu64, i);
+    CHECK(!gimli_hash_find_u64(h, i, &item), "find deleted %" PRIu64, i);
+  }
+  CHECK(dtor_calls == 20, "%d destructor calls", dtor_calls);
+  CHECK(gimli_hash_size(h) == NKEYS - 20, "size %d", gimli_hash_size(h));
+
+  /* the rest are intact, and deleted keys can be inserted again */
+  for (i = 21; i <= NKEYS; i++) {
+    CHECK(gimli_hash_find_u64(h, i, &item) && item == (void*)(uintptr_t)i,
+        "find %" PRIu64, i);
+  }
+  for (i = 1; i <= 20; i++) {
+    CHECK(gimli_hash_insert_u64(h, i, (void*)(uintptr_t)i),
+        "reinsert %" PRIu64, i);
+    CHECK(!gimli_hash_insert_u64(h, i, NULL), "duplicate %" PRIu64, i);
+  }
+  CHECK(gimli_hash_size(h) == NKEYS, "size %d", gimli_hash_size(h));
+
+  /* start another resize and empty the table while it runs */
+  for (i = NKEYS + 1; i <= NKEYS * 2; i++) {
+    gimli_hash_insert_u64(h, i, (void*)(uintptr_t)i);
+  }
+  dtor_calls = 0;
+  for (i = 1; i <= NKEYS * 2; i++) {
+    CHECK(gimli_hash_delete_u64(h, i), "delete %" PRIu64, i);
+  }
+  CHECK(dtor_calls == NKEYS * 2, "%d destructor calls", dtor_calls);
+  CHECK(gimli_hash_size(h) == 0, "size %d", gimli_hash_size(h));
+  for (i = 1; i <= NKEYS * 2; i++) {
+    CHECK(!gimli_hash_find_u64(h, i, &item), "find deleted %" PRIu64, i);
+  }
+
+  gimli_hash_destroy(h);
+}
+
+static void test_strings(void)
+{
+  gimli_hash_t h = gimli_hash_new(count_dtor);
+  char key[32];
+  void *item;
+  int i;
+
+  dtor_calls = 0;
+  for (i = 0; i < NKEYS; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    CHECK(gimli_hash_insert(h, key, (void*)(intptr_t)(i + 1)), "insert %s", key);
+  }
+  for (i = 0; i < NKEYS; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    CHECK(gimli_hash_find(h, key, &item) && item == (void*)(intptr_t)(i + 1),
+        "find %s", key);
+    CHECK(gimli_hash_delete(h, key), "delete %s", key);
+    CHECK(!gimli_hash_delete(h, key), "second delete %s", key);
+    CHECK(!gimli_hash_find(h, key, &item), "find deleted %s", key);
+  }
+  CHECK(dtor_calls == NKEYS, "%d destructor calls", dtor_calls);
+  CHECK(gimli_hash_size(h) == 0, "size %d", gimli_hash_size(h));
+
+  gimli_hash_destroy(h);
+}
+
+static gimli_iter_status_t save_key(const char *k, int klen, void *item,
+    void *arg)
+{
+  const char **keys = arg;
+
+  keys[(intptr_t)item - 1] = k;
+  return GIMLI_ITER_CONT;
+}
+
+/* the key pointers handed out by the iterator stay valid while their
+ * items remain, however much the table changes around them */
+static void test_stable_keys(void)
+{
+  gimli_hash_t h = gimli_hash_new(NULL);
+  const char **keys = calloc(NKEYS, sizeof(*keys));
+  char key[32];
+  int i;
+
+  for (i = 0; i < NKEYS / 4; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    gimli_hash_insert(h, key, (void*)(intptr_t)(i + 1));
+  }
+  gimli_hash_iter(h, save_key, keys);
+
+  /* grow the table, then delete most of what it holds */
+  for (i = NKEYS / 4; i < NKEYS; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    gimli_hash_insert(h, key, (void*)(intptr_t)(i + 1));
+  }
+  for (i = 1; i < NKEYS; i++) {
+    if (i % 8) {
+      snprintf(key, sizeof(key), "key%d", i);
+      gimli_hash_delete(h, key);
+    }
+  }
+
+  for (i = 0; i < NKEYS / 4; i += 8) {
+    snprintf(key, sizeof(key), "key%d", i);
+    CHECK(keys[i] && !strcmp(keys[i], key), "key %s moved", key);
+  }
+
+  free(keys);
+  gimli_hash_destroy(h);
+}
+
+int main(int argc, char *argv[])
+{
+  /* a table that loses track of its items can probe forever */
+  alarm(60);
+
+  test_u64();
+  test_strings();
+  test_stable_keys();
+
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -4,6 +4,35 @@
  * https://bitbucket.org/wez/gimli/src/tip/LICENSE
  */
 #include "impl.h"
+#include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* The table is open addressed, in the style of Google's SwissTable.
+ * Slots are arranged in groups of GROUP_SIZE and a parallel array of
+ * control bytes records whether each slot is empty, deleted, or holds
+ * an item, in which case it also holds 7 bits of the key's hash.
+ * A lookup compares those bits against a whole group of control bytes
+ * at once and only examines the slots that match, moving on through
+ * the groups of its probe sequence until it meets a group with an
+ * empty slot. */
+
+#define GROUP_SIZE 16
+#define CTRL_EMPTY   ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xfe)
+#define CTRL_IS_FULL(c) (((c) & 0x80) == 0)
+
+/* duplicated string keys are carved out of chunks of this size,
+ * growing as the table does */
+#define KEY_CHUNK_MIN 256
+#define KEY_CHUNK_MAX 65536
+
+/* tables of at least this many slots are resized incrementally; each
+ * operation on the table moves the items from HASH_MIGRATE_STEP slots
+ * of the old table */
+#define HASH_INCREMENTAL_MIN 8192
+#define HASH_MIGRATE_STEP 64
 
 typedef struct {
 	union {
@@ -12,195 +41,361 @@ typedef struct {
 		uint64_t u64;
 	} u;
 	uint32_t len;
+	/* the hash is kept so that rehashing doesn't recompute it, and so
+	 * that a tag collision rarely costs a string comparison */
+	uint32_t hash;
 } hash_key_t;
 
-typedef struct gimli_hash_bucket {
+typedef struct gimli_hash_slot {
 	hash_key_t k;
 	void *item;
-	struct gimli_hash_bucket *next;
-} gimli_hash_bucket;
+} gimli_hash_slot;
 
-struct libgimli_hash_table {
-	gimli_hash_bucket **buckets;
+struct hash_key_chunk {
+	struct hash_key_chunk *next;
+	uint32_t used, size;
+	char data[1];
+};
+
+struct hash_tab {
+	uint8_t *ctrl;
+	gimli_hash_slot *slots;
+	/* number of slots; a power of 2, and at least GROUP_SIZE */
 	uint32_t table_size;
-	uint32_t initval;
+	/* slots that are neither occupied nor deleted */
+	uint32_t empty;
+};
+
+struct libgimli_hash_table {
+	struct hash_tab tab;
+	/* When a large table is resized, its items move to the new table a
+	 * few groups at a time as the table is used, rather than all at
+	 * once.  Until then, old holds the table being drained and
+	 * migrate_pos is the first of its slots yet to be moved */
+	struct hash_tab old;
+	uint32_t migrate_pos;
 	uint32_t size;
 	uint32_t flags;
+	uint64_t seed;
 	unsigned vers;
 	int no_rebucket;
-	void (*compile_key)(hash_key_t *key);
-	int (*copy_key)(gimli_hash_bucket *b, hash_key_t *key);
-	uint32_t (*hash)(hash_key_t *key, uint32_t initval);
-	int (*same_key)(gimli_hash_bucket *b, hash_key_t *key);
-	struct gimli_slab bucketslab;
+	void (*compile_key)(gimli_hash_t h, hash_key_t *key);
+	int (*same_key)(gimli_hash_slot *s, hash_key_t *key);
+	/* storage for duplicated keys */
+	struct hash_key_chunk *keys;
+	uint64_t key_bytes, dead_key_bytes;
 	gimli_hash_free_func_t dtor;
 };
 
+/* This is wyhash, from https://github.com/wangyi-fudan/wyhash,
+ * which is in the public domain */
+
+static const uint64_t wyp[4] = {
+	0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+	0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
 
-/* This is from http://burtleburtle.net/bob/hash/doobs.html */
+static inline void wymum(uint64_t *A, uint64_t *B)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = *A;
 
-#define mix(a,b,c) \
-{ \
-  a -= b; a -= c; a ^= (c>>13); \
-  b -= c; b -= a; b ^= (a<<8); \
-  c -= a; c -= b; c ^= (b>>13); \
-  a -= b; a -= c; a ^= (c>>12);  \
-  b -= c; b -= a; b ^= (a<<16); \
-  c -= a; c -= b; c ^= (b>>5); \
-  a -= b; a -= c; a ^= (c>>3);  \
-  b -= c; b -= a; b ^= (a<<10); \
-  c -= a; c -= b; c ^= (b>>15); \
+	r *= *B;
+	*A = (uint64_t)r;
+	*B = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *A >> 32, hb = *B >> 32;
+	uint64_t la = (uint32_t)*A, lb = (uint32_t)*B, hi, lo;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	*A = lo;
+	*B = hi;
+#endif
 }
 
-static void u64_key_compile(hash_key_t *key)
+static inline uint64_t wymix(uint64_t A, uint64_t B)
 {
-	key->len = sizeof(uint64_t);
+	wymum(&A, &B);
+	return A ^ B;
 }
 
-static int u64_key_copy(gimli_hash_bucket *b, hash_key_t *key)
+static inline uint64_t wyr8(const uint8_t *p)
 {
-	b->k = *key;
-	return 1;
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
 }
 
-static uint32_t u64_key_hash(hash_key_t *hkey, uint32_t initval)
+static inline uint64_t wyr4(const uint8_t *p)
 {
-#if 0
-	uint32_t a = 0, b = hkey->u.u64 >> 32;
-	uint32_t c = hkey->u.u64 & 0xffffffff;
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
 
-	mix(a, b, c);
-	return c;
-#elif 1
-	/* http://www.cris.com/~Ttwang/tech/inthash.htm -> hash6432shift */
-	uint64_t key = hkey->u.u64;
+static inline uint64_t wyr3(const uint8_t *p, size_t k)
+{
+	return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
 
-  key = (~key) + (key << 18); // key = (key << 18) - key - 1;
-  key = key ^ (key >> 31);
-  key = key * 21; // key = (key + (key << 2)) + (key << 4);
-  key = key ^ (key >> 11);
-  key = key + (key << 6);
-  key = key ^ (key >> 22);
-  return (uint32_t) key;
+static uint64_t wyhash(const void *key, size_t len, uint64_t seed)
+{
+	const uint8_t *p = key;
+	uint64_t a, b;
+	size_t i;
+
+	seed ^= wymix(seed ^ wyp[0], wyp[1]);
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+			b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = wyr3(p, len);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		i = len;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+
+			do {
+				seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+				see1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+				see2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = wyr8(p + i - 16);
+		b = wyr8(p + i - 8);
+	}
+	a ^= wyp[1];
+	b ^= seed;
+	wymum(&a, &b);
+	return wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+/* integer keys; pointers in particular have predictable low bits,
+ * which would otherwise all land in the same tag */
+static inline uint64_t wyhash64(uint64_t A, uint64_t B)
+{
+	A ^= 0x2d358dccaa6c78a5ULL;
+	B ^= 0x8bb84b93962eacc9ULL;
+	wymum(&A, &B);
+	return wymix(A ^ 0x2d358dccaa6c78a5ULL, B ^ 0x8bb84b93962eacc9ULL);
+}
+
+/* Group probing.  Each returns a bitmask with bit i set if control
+ * byte i of the group satisfies the test */
+
+#ifdef __SSE2__
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t tag)
+{
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+
+	return (uint32_t)_mm_movemask_epi8(
+			_mm_cmpeq_epi8(g, _mm_set1_epi8((char)tag)));
+}
+
+/* empty or deleted: both have the high bit set */
+static inline uint32_t group_match_free(const uint8_t *ctrl)
+{
+	return (uint32_t)_mm_movemask_epi8(
+			_mm_loadu_si128((const __m128i*)ctrl));
+}
 #else
-	return (uint32_t)hkey->u.u64;
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t tag)
+{
+	uint32_t m = 0;
+	int i;
+
+	for (i = 0; i < GROUP_SIZE; i++) {
+		if (ctrl[i] == tag) {
+			m |= 1 << i;
+		}
+	}
+	return m;
+}
+
+static inline uint32_t group_match_free(const uint8_t *ctrl)
+{
+	uint32_t m = 0;
+	int i;
+
+	for (i = 0; i < GROUP_SIZE; i++) {
+		if (ctrl[i] & 0x80) {
+			m |= 1 << i;
+		}
+	}
+	return m;
+}
 #endif
+
+static inline uint32_t group_match_empty(const uint8_t *ctrl)
+{
+	return group_match(ctrl, CTRL_EMPTY);
 }
 
-static int u64_key_same(gimli_hash_bucket *b, hash_key_t *key)
+static inline uint8_t hash_tag(uint32_t hash)
 {
-	return b->k.u.u64 == key->u.u64;
+	return hash & 0x7f;
 }
 
-static void ptr_key_compile(hash_key_t *key)
+static inline uint32_t hash_group(struct hash_tab *t, uint32_t hash)
+{
+	return (hash >> 7) & ((t->table_size / GROUP_SIZE) - 1);
+}
+
+static void u64_key_compile(gimli_hash_t h, hash_key_t *key)
+{
+	key->len = sizeof(uint64_t);
+	key->hash = (uint32_t)wyhash64(key->u.u64, h->seed);
+}
+
+static int u64_key_same(gimli_hash_slot *s, hash_key_t *key)
+{
+	return s->k.u.u64 == key->u.u64;
+}
+
+static void ptr_key_compile(gimli_hash_t h, hash_key_t *key)
 {
 	key->len = sizeof(void*);
+	key->hash = (uint32_t)wyhash64((uint64_t)(intptr_t)key->u.ptr, h->seed);
 }
 
-static int ptr_key_copy(gimli_hash_bucket *b, hash_key_t *key)
+static int ptr_key_same(gimli_hash_slot *s, hash_key_t *key)
 {
-	b->k = *key;
-	return 1;
+	return s->k.u.ptr == key->u.ptr;
 }
 
-static uint32_t ptr_key_hash(hash_key_t *key, uint32_t initval)
+static void string_key_compile(gimli_hash_t h, hash_key_t *key)
 {
-	return (uint32_t)(intptr_t)key->u.ptr;
+	key->len = strlen(key->u.str);
+	key->hash = (uint32_t)wyhash(key->u.str, key->len, h->seed);
 }
 
-static int ptr_key_same(gimli_hash_bucket *b, hash_key_t *key)
+static int string_key_same(gimli_hash_slot *s, hash_key_t *k)
 {
-	return b->k.u.ptr == key->u.ptr;
+	return s->k.len == k->len && !memcmp(s->k.u.str, k->u.str, k->len);
 }
 
-static int string_key_dup(gimli_hash_bucket *b, hash_key_t *key)
+static char *key_alloc(gimli_hash_t h, uint32_t len)
 {
-	b->k = *key;
-	b->k.u.str = malloc(key->len + 1);
-	if (!b->k.u.str) return 0;
-	memcpy(b->k.u.str, key->u.str, key->len);
-	b->k.u.str[key->len] = '\0';
+	struct hash_key_chunk *c = h->keys;
+	uint32_t size;
+	char *p;
+
+	if (!c || c->size - c->used < len) {
+		size = c ? c->size * 2 : KEY_CHUNK_MIN;
+		if (size > KEY_CHUNK_MAX) size = KEY_CHUNK_MAX;
+		if (size < len) size = len;
+
+		c = malloc(sizeof(*c) + size);
+		if (!c) return NULL;
+		c->size = size;
+		c->used = 0;
+		c->next = h->keys;
+		h->keys = c;
+	}
+	p = c->data + c->used;
+	c->used += len;
+	h->key_bytes += len;
+	return p;
+}
+
+static void free_keys(struct hash_key_chunk *c)
+{
+	struct hash_key_chunk *next;
+
+	while (c) {
+		next = c->next;
+		free(c);
+		c = next;
+	}
+}
+
+static int copy_key(gimli_hash_t h, gimli_hash_slot *s, hash_key_t *key)
+{
+	s->k = *key;
+	if (h->flags & GIMLI_HASH_DUP_KEYS) {
+		s->k.u.str = key_alloc(h, key->len + 1);
+		if (!s->k.u.str) return 0;
+		memcpy(s->k.u.str, key->u.str, key->len);
+		s->k.u.str[key->len] = '\0';
+	}
 	return 1;
 }
 
+static int alloc_tab(struct hash_tab *t, uint32_t size)
+{
+	if (size < GROUP_SIZE) size = GROUP_SIZE;
+
+	t->ctrl = malloc(size);
+	t->slots = malloc(size * sizeof(*t->slots));
+	if (!t->ctrl || !t->slots) {
+		free(t->ctrl);
+		free(t->slots);
+		t->ctrl = NULL;
+		t->slots = NULL;
+		return 0;
+	}
+	memset(t->ctrl, CTRL_EMPTY, size);
+	t->table_size = size;
+	t->empty = size;
+	return 1;
+}
 
-static void string_key_compile(hash_key_t *key)
+static void free_tab(struct hash_tab *t)
 {
-	key->len = strlen(key->u.str);
+	free(t->ctrl);
+	free(t->slots);
+	memset(t, 0, sizeof(*t));
 }
 
-static int string_key_same(gimli_hash_bucket *b, hash_key_t *k)
-{
-	return b->k.len == k->len && !memcmp(b->k.u.str, k->u.str, k->len);
-}
-
-static uint32_t string_key_hash(hash_key_t *key, uint32_t initval)
-{
-   register uint32_t a,b,c,len;
-   const char *k = key->u.ptr;
-
-   /* Set up the internal state */
-   len = key->len;
-   a = b = 0x9e3779b9;  /* the golden ratio; an arbitrary value */
-   c = initval;         /* the previous hash value */
-
-   /*---------------------------------------- handle most of the key */
-   while (len >= 12)
-   {
-      a += (k[0] +((uint32_t)k[1]<<8) +((uint32_t)k[2]<<16) +((uint32_t)k[3]<<24));
-      b += (k[4] +((uint32_t)k[5]<<8) +((uint32_t)k[6]<<16) +((uint32_t)k[7]<<24));
-      c += (k[8] +((uint32_t)k[9]<<8) +((uint32_t)k[10]<<16)+((uint32_t)k[11]<<24));
-      mix(a,b,c);
-      k += 12; len -= 12;
-   }
-
-   /*------------------------------------- handle the last 11 bytes */
-   c += key->len;
-   switch(len)              /* all the case statements fall through */
-   {
-   case 11: c+=((uint32_t)k[10]<<24);
-   case 10: c+=((uint32_t)k[9]<<16);
-   case 9 : c+=((uint32_t)k[8]<<8);
-      /* the first byte of c is reserved for the length */
-   case 8 : b+=((uint32_t)k[7]<<24);
-   case 7 : b+=((uint32_t)k[6]<<16);
-   case 6 : b+=((uint32_t)k[5]<<8);
-   case 5 : b+=k[4];
-   case 4 : a+=((uint32_t)k[3]<<24);
-   case 3 : a+=((uint32_t)k[2]<<16);
-   case 2 : a+=((uint32_t)k[1]<<8);
-   case 1 : a+=k[0];
-     /* case 0: nothing left to add */
-   }
-   mix(a,b,c);
-   /*-------------------------------------------- report the result */
-   return c;
+/* tables are created by the object loading threads too, so the seed
+ * comes from a counter and the address of the table rather than from
+ * the MT-unsafe lrand48 */
+static uint64_t seed_counter;
+
+static uint64_t new_seed(gimli_hash_t h)
+{
+	return wyhash64((uint64_t)(intptr_t)h,
+			__sync_add_and_fetch(&seed_counter, 1) * wyp[0]);
 }
 
 gimli_hash_t gimli_hash_new_size(gimli_hash_free_func_t dtor, uint32_t flags, size_t size)
 {
 	gimli_hash_t h = calloc(1, sizeof(*h));
-	h->initval = lrand48();
+	h->seed = new_seed(h);
 	h->flags = flags;
-	h->table_size = size ? power_2(size) : GIMLI_HASH_INITIAL_SIZE;
-	h->buckets = calloc(h->table_size, sizeof(gimli_hash_bucket*));
 	h->dtor = dtor;
-	gimli_slab_init(&h->bucketslab, sizeof(gimli_hash_bucket), "buckets");
+	if (!alloc_tab(&h->tab, size ? power_2(size) : GIMLI_HASH_INITIAL_SIZE)) {
+		free(h);
+		return NULL;
+	}
 
 	if (flags & GIMLI_HASH_PTR_KEYS) {
 		h->compile_key = ptr_key_compile;
-		h->copy_key = ptr_key_copy;
-		h->hash = ptr_key_hash;
 		h->same_key = ptr_key_same;
 	} else if (flags & GIMLI_HASH_U64_KEYS) {
 		h->compile_key = u64_key_compile;
-		h->copy_key = u64_key_copy;
-		h->hash = u64_key_hash;
 		h->same_key = u64_key_same;
 	} else {
 		h->compile_key = string_key_compile;
-		h->copy_key = (flags & GIMLI_HASH_DUP_KEYS) ? string_key_dup : ptr_key_copy;
-		h->hash = string_key_hash;
 		h->same_key = string_key_same;
 	}
 
@@ -212,143 +407,232 @@ gimli_hash_t gimli_hash_new(gimli_hash_free_func_t dtor)
 	return gimli_hash_new_size(dtor, GIMLI_HASH_DUP_KEYS, GIMLI_HASH_INITIAL_SIZE);
 }
 
-static void free_bucket(gimli_hash_t h, gimli_hash_bucket *b)
+static void free_slot(gimli_hash_t h, gimli_hash_slot *s)
 {
 	if (h->flags & GIMLI_HASH_DUP_KEYS) {
-		free(b->k.u.str);
+		/* keys never move, as callers may hold on to the key pointers
+		 * that gimli_hash_iter hands out; the storage is reclaimed once
+		 * the table is emptied */
+		h->dead_key_bytes += s->k.len + 1;
 	}
 	if (h->dtor) {
-		h->dtor(b->item);
+		h->dtor(s->item);
 	}
-//	free(b);
 }
 
-static gimli_hash_bucket *new_bucket(gimli_hash_t h, hash_key_t *key, void *item)
+/* returns the index of the slot of t holding key, or -1 */
+static int64_t find_slot(gimli_hash_t h, struct hash_tab *t, hash_key_t *key)
+{
+	uint32_t g = hash_group(t, key->hash);
+	uint32_t mask = (t->table_size / GROUP_SIZE) - 1;
+	uint8_t tag = hash_tag(key->hash);
+	uint32_t step = 0, m, i;
+	const uint8_t *ctrl;
+	gimli_hash_slot *s;
+
+	for (;;) {
+		ctrl = t->ctrl + (g * GROUP_SIZE);
+		m = group_match(ctrl, tag);
+		while (m) {
+			i = ffs(m) - 1;
+			m &= m - 1;
+			s = &t->slots[(g * GROUP_SIZE) + i];
+			if (s->k.hash == key->hash && h->same_key(s, key)) {
+				return (g * GROUP_SIZE) + i;
+			}
+		}
+		if (group_match_empty(ctrl)) {
+			return -1;
+		}
+		g = (g + ++step) & mask;
+	}
+}
+
+/* returns the index of the first empty or deleted slot in the probe
+ * sequence for hash */
+static uint32_t find_free(struct hash_tab *t, uint32_t hash)
 {
-	gimli_hash_bucket *b;
+	uint32_t g = hash_group(t, hash);
+	uint32_t mask = (t->table_size / GROUP_SIZE) - 1;
+	uint32_t step = 0, m;
 
-	b = gimli_slab_alloc(&h->bucketslab);
+	for (;;) {
+		m = group_match_free(t->ctrl + (g * GROUP_SIZE));
+		if (m) {
+			return (g * GROUP_SIZE) + ffs(m) - 1;
+		}
+		g = (g + ++step) & mask;
+	}
+}
 
-	if (!b) return NULL;
-	memset(b, 0, sizeof(*b));
+static void set_slot(struct hash_tab *t, uint32_t idx, hash_key_t *key,
+		void *item)
+{
+	if (t->ctrl[idx] == CTRL_EMPTY) {
+		t->empty--;
+	}
+	t->ctrl[idx] = hash_tag(key->hash);
+	t->slots[idx].k = *key;
+	t->slots[idx].item = item;
+}
 
-	if (!h->copy_key(b, key)) {
-		free(b);
-		return NULL;
+static void clear_slot(struct hash_tab *t, uint32_t idx)
+{
+	/* if the group still has an empty slot, then no probe ever
+	 * passed through it to reach another group, and the slot can be
+	 * made empty again.  Otherwise it must remain a tombstone */
+	if (group_match_empty(t->ctrl + (idx & ~(GROUP_SIZE - 1)))) {
+		t->ctrl[idx] = CTRL_EMPTY;
+		t->empty++;
+	} else {
+		t->ctrl[idx] = CTRL_DELETED;
 	}
+}
+
+/* moves up to n slots worth of items from the old table into the
+ * current one, releasing the old table once it has been drained */
+static void migrate(gimli_hash_t h, uint32_t n)
+{
+	struct hash_tab *old = &h->old;
+	gimli_hash_slot *s;
 
-	b->item = item;
-	return b;
+	if (!old->ctrl || h->no_rebucket) return;
+
+	while (n-- && h->migrate_pos < old->table_size) {
+		if (CTRL_IS_FULL(old->ctrl[h->migrate_pos])) {
+			s = &old->slots[h->migrate_pos];
+			set_slot(&h->tab, find_free(&h->tab, s->k.hash), &s->k, s->item);
+			/* the item now lives only in the new table; the old slot
+			 * must not be found again, but stays a tombstone so that
+			 * probes for the items yet to move pass through it */
+			old->ctrl[h->migrate_pos] = CTRL_DELETED;
+		}
+		h->migrate_pos++;
+	}
+	if (h->migrate_pos >= old->table_size) {
+		free_tab(old);
+		h->migrate_pos = 0;
+	}
 }
 
-static void rebucket(gimli_hash_t h, int newsize)
+static void rebucket(gimli_hash_t h, uint32_t newsize)
 {
-	int i, newoff;
-	gimli_hash_bucket **newbuckets, *b, *n;
+	struct hash_tab old;
 
 	if (h->no_rebucket) return;
 
-//printf("rebucket(%p, %d) %d\n", h, newsize, h->size);
-	i = newsize;
-	while (i) {
-		if (i & 1) break;
-		i >>= 1;
+	/* only one resize can be in flight.  The old table has normally
+	 * drained long before another resize is due; if it hasn't, put
+	 * the resize off while this table still has room, rather than
+	 * moving everything that is left within a single operation */
+	if (h->old.ctrl) {
+		if (h->tab.empty > 1) return;
+		migrate(h, UINT32_MAX);
 	}
-	if (i & ~1) {
+
+	old = h->tab;
+	if (!alloc_tab(&h->tab, newsize)) {
+		h->tab = old;
 		return;
 	}
-	newbuckets = calloc(newsize, sizeof(*b));
-	for (i = 0; i < h->table_size; i++) {
-		b = h->buckets[i];
-		while (b) {
-			n = b->next;
-			newoff = h->hash(&b->k, h->initval) & (newsize-1);
-			b->next = newbuckets[newoff];
-			newbuckets[newoff] = b;
-			b = n;
+	h->old = old;
+	h->migrate_pos = 0;
+
+	/* small tables are cheap enough to move in one go */
+	if (old.table_size < HASH_INCREMENTAL_MIN) {
+		migrate(h, UINT32_MAX);
+	}
+}
+
+/* returns the table holding key, and its slot there */
+static struct hash_tab *find_key(gimli_hash_t h, hash_key_t *key,
+		int64_t *idx)
+{
+	*idx = find_slot(h, &h->tab, key);
+	if (*idx >= 0) {
+		return &h->tab;
+	}
+	if (h->old.ctrl) {
+		*idx = find_slot(h, &h->old, key);
+		if (*idx >= 0) {
+			return &h->old;
 		}
 	}
-	free(h->buckets);
-	h->table_size = newsize;
-	h->buckets = newbuckets;
+	return NULL;
 }
 
 static int do_hash_insert(gimli_hash_t h, hash_key_t *key, void *item)
 {
-	int off;
-	gimli_hash_bucket *b;
+	gimli_hash_slot s;
+	int64_t idx;
 
-	h->compile_key(key);
+	h->compile_key(h, key);
+	migrate(h, HASH_MIGRATE_STEP);
 
-	off = h->hash(key, h->initval) & (h->table_size - 1);
-	b = h->buckets[off];
-	while (b) {
-		if (h->same_key(b, key)) {
+	if (find_key(h, key, &idx)) {
+		return 0;
+	}
+
+	/* keep at least an eighth of the slots empty, so that probes
+	 * terminate quickly.  If deletions are what used them up, rehash
+	 * at the same size to clear them out */
+	if (h->tab.empty <= h->tab.table_size / 8) {
+		if (h->size >= (h->tab.table_size / 8) * 5) {
+			rebucket(h, h->tab.table_size << 1);
+		} else {
+			rebucket(h, h->tab.table_size);
+		}
+		if (h->tab.empty <= 1) {
+			/* not allowed to rebucket right now */
 			return 0;
 		}
-		b = b->next;
 	}
-	b = new_bucket(h, key, item);
-	b->next = h->buckets[off];
-	h->buckets[off] = b;
-	h->size++;
-	h->vers++;
 
-	if (h->size > h->table_size - (h->table_size >> 3)) {
-		rebucket(h, h->table_size << 1);
+	if (!copy_key(h, &s, key)) {
+		return 0;
 	}
+	set_slot(&h->tab, find_free(&h->tab, key->hash), &s.k, item);
+	h->size++;
+	h->vers++;
 	return 1;
 }
 
 static int do_hash_find(gimli_hash_t h, hash_key_t *key, void **item_p)
 {
-	int off;
-	gimli_hash_bucket *b;
+	struct hash_tab *t;
+	int64_t idx;
 
-	h->compile_key(key);
+	h->compile_key(h, key);
+	migrate(h, HASH_MIGRATE_STEP);
 
-	off = h->hash(key, h->initval) & (h->table_size - 1);
-	b = h->buckets[off];
-	while (b) {
-		if (h->same_key(b, key)) {
-			if (item_p) {
-				*item_p = b->item;
-			}
-			return 1;
-		}
-		b = b->next;
+	t = find_key(h, key, &idx);
+	if (!t) {
+		return 0;
+	}
+	if (item_p) {
+		*item_p = t->slots[idx].item;
 	}
-	return 0;
+	return 1;
 }
 
 static int do_hash_delete(gimli_hash_t h, hash_key_t *key)
 {
-	int off;
-	gimli_hash_bucket *b, *prev = NULL;
+	struct hash_tab *t;
+	int64_t idx;
 
-	h->compile_key(key);
+	h->compile_key(h, key);
+	migrate(h, HASH_MIGRATE_STEP);
 
-	off = h->hash(key, h->initval) & (h->table_size - 1);
-	b = h->buckets[off];
-	while (b) {
-		if (h->same_key(b, key)) {
-			break;
-		}
-		prev = b;
-		b = b->next;
-	}
-	if (!b) return 0;
-	if (!prev) {
-		h->buckets[off] = b->next;
-	} else {
-		prev->next = b->next;
-	}
-	free_bucket(h, b);
+	t = find_key(h, key, &idx);
+	if (!t) return 0;
+
+	free_slot(h, &t->slots[idx]);
+	clear_slot(t, idx);
 	h->size--;
 	h->vers++;
-	if (h->table_size > GIMLI_HASH_INITIAL_SIZE &&
-			h->size < h->table_size >> 2) {
-		rebucket(h, h->table_size >> 1);
+	if (h->tab.table_size > GIMLI_HASH_INITIAL_SIZE &&
+			h->size < h->tab.table_size >> 2) {
+		rebucket(h, h->tab.table_size >> 1);
 	}
 	return 1;
 }
@@ -436,58 +720,67 @@ int gimli_hash_insert_ptr(gimli_hash_t h, void * k, void *item)
 
 void gimli_hash_delete_all(gimli_hash_t h, int downsize)
 {
-	int i;
-	gimli_hash_bucket *b, *tofree;
+	uint32_t i;
 
 	h->no_rebucket++;
-	for (i = 0; i < h->table_size; i++) {
-		b = h->buckets[i];
-		while (b) {
-			tofree = b;
-			b = b->next;
-			free_bucket(h, tofree);
+	for (i = 0; i < h->tab.table_size; i++) {
+		if (CTRL_IS_FULL(h->tab.ctrl[i])) {
+			free_slot(h, &h->tab.slots[i]);
+		}
+	}
+	for (i = h->migrate_pos; i < h->old.table_size; i++) {
+		if (CTRL_IS_FULL(h->old.ctrl[i])) {
+			free_slot(h, &h->old.slots[i]);
 		}
-		h->buckets[i] = NULL;
 	}
+	free_tab(&h->old);
+	h->migrate_pos = 0;
+	memset(h->tab.ctrl, CTRL_EMPTY, h->tab.table_size);
+	h->tab.empty = h->tab.table_size;
 	h->size = 0;
+	free_keys(h->keys);
+	h->keys = NULL;
+	h->key_bytes = 0;
+	h->dead_key_bytes = 0;
 	h->no_rebucket--;
-	if (downsize) {
+	if (downsize && h->tab.table_size != GIMLI_HASH_INITIAL_SIZE) {
 		rebucket(h, GIMLI_HASH_INITIAL_SIZE);
 	}
-	gimli_slab_destroy(&h->bucketslab);
-	gimli_slab_init(&h->bucketslab, sizeof(gimli_hash_bucket), "buckets");
 }
 
 void gimli_hash_destroy(gimli_hash_t h)
 {
 	gimli_hash_delete_all(h, 0);
-	gimli_slab_destroy(&h->bucketslab);
-	if (h->buckets) {
-		free(h->buckets);
-		h->buckets = NULL;
-	}
+	free_tab(&h->tab);
 	free(h);
 }
 
+static int iter_tab(struct hash_tab *t, uint32_t start,
+		gimli_hash_iter_func_t func, void *arg, int *visited)
+{
+	gimli_hash_slot *s;
+	uint32_t i;
+
+	for (i = start; i < t->table_size; i++) {
+		if (!CTRL_IS_FULL(t->ctrl[i])) continue;
+		s = &t->slots[i];
+		++*visited;
+		if (func(s->k.u.str, s->k.len, s->item, arg) != GIMLI_ITER_CONT) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
 int gimli_hash_iter(gimli_hash_t h, gimli_hash_iter_func_t func, void *arg)
 {
-	int i;
-	gimli_iter_status_t ret;
-	gimli_hash_bucket *b;
 	int visited = 0;
 
 	h->no_rebucket++;
-	for (i = 0; i < h->table_size; i++) {
-		b = h->buckets[i];
-		while (b) {
-			++visited;
-			ret = func(b->k.u.str, b->k.len, b->item, arg);
-			if (ret != GIMLI_ITER_CONT) {
-				return visited;
-			}
-			b = b->next;
-		}
+	if (iter_tab(&h->tab, 0, func, arg, &visited)) {
+		iter_tab(&h->old, h->migrate_pos, func, arg, &visited);
 	}
+	h->no_rebucket--;
 	return visited;
 }
 
@@ -498,37 +791,47 @@ int gimli_hash_size(gimli_hash_t h)
 
 void gimli_hash_diagnose(gimli_hash_t h)
 {
-	int num_empty = 0;
-	int num_perfect = 0;
-	int num_collided = 0;
-	int largest_chain = 0;
-	int i;
-	gimli_hash_bucket *b;
-
-	for (i = 0; i < h->table_size; i++) {
-		int run = 0;
-		b = h->buckets[i];
-		if (!b) {
-			num_empty++;
+	struct hash_tab *t = &h->tab;
+	uint32_t mask = (t->table_size / GROUP_SIZE) - 1;
+	uint32_t num_deleted = 0;
+	uint32_t num_displaced = 0;
+	uint32_t longest_probe = 0;
+	uint64_t total_probe = 0;
+	uint32_t i, g, step, probe, live = 0;
+
+	for (i = 0; i < t->table_size; i++) {
+		if (t->ctrl[i] == CTRL_DELETED) {
+			num_deleted++;
 			continue;
 		}
-		if (!b->next) {
-			num_perfect++;
-			continue;
-		}
-		num_collided++;
-		while (b) {
-			run++;
-
-			b = b->next;
+		if (!CTRL_IS_FULL(t->ctrl[i])) continue;
+
+		/* count the groups that a lookup of this key visits */
+		g = hash_group(t, t->slots[i].k.hash);
+		step = 0;
+		probe = 1;
+		while (g != i / GROUP_SIZE) {
+			g = (g + ++step) & mask;
+			probe++;
 		}
-		if (run > largest_chain) largest_chain = run;
+		if (probe > 1) num_displaced++;
+		if (probe > longest_probe) longest_probe = probe;
+		total_probe += probe;
+		live++;
 	}
 
-	printf("num_empty=%d num_perfect=%d num_collided=%d %.0f%% largest=%d\n",
-			num_empty, num_perfect, num_collided,
-			h->size ? ((float)num_collided / (float)h->size * 100.0) : 0.0,
-			largest_chain);
+	printf("size=%u slots=%u load=%.0f%% deleted=%u displaced=%u "
+			"avg_probe=%.2f longest_probe=%u keybytes=%" PRIu64 "/%" PRIu64 "\n",
+			h->size, t->table_size,
+			(float)live / (float)t->table_size * 100.0,
+			num_deleted, num_displaced,
+			live ? (float)total_probe / (float)live : 0.0,
+			longest_probe,
+			h->key_bytes - h->dead_key_bytes, h->key_bytes);
+	if (h->old.ctrl) {
+		printf("migrating from %u slots: %u/%u moved\n",
+				h->old.table_size, h->migrate_pos, h->old.table_size);
+	}
 }
 
 /* vim:ts=2:sw=2:noet:
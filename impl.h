@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -154,6 +155,10 @@ struct gimli_unwind_cursor {
   int frameno;
   int tid;
   int dwarffail;
+  /* the CFA of this frame for DW_OP_call_frame_cfa, computed on first
+   * use; cleared whenever the cursor is unwound to the caller */
+  int have_cfa;
+  gimli_addr_t cfa;
 };
 
 struct dw_secinfo {
@@ -163,6 +168,39 @@ struct dw_secinfo {
   char *cur;
 };
 
+struct gimli_slab_page {
+  LIST_ENTRY(gimli_slab_page) list;
+  /* bytes in the page, including this header */
+  size_t size;
+  /* mmap'd rather than malloc'd */
+  int mapped;
+};
+
+/* pages at least this large are mapped and backed by huge pages */
+#define GIMLI_SLAB_HUGE_PAGE (2*1024*1024)
+
+struct gimli_slab {
+  LIST_HEAD(slab, gimli_slab_page) pages;
+  uint32_t item_size, per_page;
+  uint32_t next_avail, total_allocd;
+  size_t base_page_size, page_size, max_page_size;
+  /* reported by gimli_slab_dump */
+  uint64_t npages, page_bytes, wasted;
+  const char *name;
+};
+
+int gimli_slab_init(struct gimli_slab *slab, uint32_t size, const char *name);
+int gimli_slab_init_size(struct gimli_slab *slab, uint32_t size,
+    const char *name, size_t page_size, size_t max_page_size);
+void *gimli_slab_alloc(struct gimli_slab *slab);
+void *gimli_slab_alloc_array(struct gimli_slab *slab, uint32_t n);
+void gimli_slab_reset(struct gimli_slab *slab);
+void gimli_slab_destroy(struct gimli_slab *slab);
+void gimli_slab_dump(struct gimli_slab *slab);
+
+/* returns the single shared copy of str; it is never freed */
+const char *gimli_intern(const char *str);
+
 struct gimli_variable {
   STAILQ_ENTRY(gimli_variable) vars;
 
@@ -176,6 +214,9 @@ struct gimli_variable {
 struct gimli_stack_frame {
   STAILQ_ENTRY(gimli_stack_frame) frames;
 
+  /* the trace that owns this frame and its variables */
+  struct gimli_stack_trace *trace;
+
   struct gimli_unwind_cursor cur;
 
   STAILQ_HEAD(vars, gimli_variable) vars;
@@ -192,13 +233,63 @@ struct gimli_stack_trace {
   int num_frames;
 
   STAILQ_HEAD(frames, gimli_stack_frame) frames;
+
+  /** the frames and their variables are carved out of these, and
+   * released all at once along with the trace */
+  struct gimli_slab frameslab, varslab;
 };
 
 
-struct gimli_line_info {
-  const char *filename;
-  uint64_t lineno;
-  gimli_addr_t addr, end;
+/* Line number information is decoded one sequence at a time.  The
+ * rows of a decoded sequence are delta encoded: each is
+ * uleb128((addr delta << 1) | file changed), sleb128(line delta) and,
+ * if the file changed, uleb128(file index).  Every GIMLI_LINE_SYNC
+ * rows, a sync point holds the absolute row instead, so that a lookup
+ * decodes at most that many rows */
+#define GIMLI_LINE_SYNC 32
+/* decoded sequences retained per object */
+#define GIMLI_LINE_LRU_MAX 64
+
+struct gimli_line_sync {
+  gimli_addr_t addr;
+  uint32_t line;
+  uint32_t file;
+  /* offset into rows of the row that follows this one */
+  uint32_t pos;
+};
+
+struct gimli_line_seq {
+  gimli_addr_t lo, hi;
+  /* first opcode of the sequence */
+  const uint8_t *start;
+  /* NULL until the sequence is decoded */
+  struct gimli_line_sync *syncs;
+  uint8_t *rows;
+  uint32_t nsyncs;
+  uint32_t rowlen;
+  TAILQ_ENTRY(gimli_line_seq) lru;
+};
+
+struct gimli_line_program {
+  /* the opcodes, following the header */
+  const uint8_t *start, *end;
+  const uint8_t *opcode_lengths;
+  uint8_t min_insn_len;
+  int8_t line_base;
+  uint8_t line_range;
+  uint8_t opcode_base;
+  uint8_t scanned;
+  const char **files;
+  /* the index into dirs of the directory of each file */
+  uint32_t *file_dirs;
+  uint32_t nfiles;
+  /* include directories; an entry of NULL, as directory 0 is before
+   * DWARF 5, stands for the compilation directory */
+  const char **dirs;
+  uint32_t ndirs;
+  /* sorted by lo */
+  struct gimli_line_seq *seqs;
+  uint32_t nseqs;
 };
 
 #ifdef __MACH__
@@ -208,7 +299,7 @@ typedef struct gimli_elf_ehdr *gimli_object_file_t;
 #endif
 
 struct gimli_section_data {
-  char *name;
+  const char *name;
   uint8_t *data;
   uint64_t size;
   uint64_t offset;
@@ -227,23 +318,8 @@ struct gimli_object_mapping {
   gimli_mapped_object_t objfile;
 };
 
-struct gimli_slab_page {
-  LIST_ENTRY(gimli_slab_page) list;
-};
-
-struct gimli_slab {
-  LIST_HEAD(slab, gimli_slab_page) pages;
-  uint32_t item_size, per_page;
-  uint32_t next_avail, total_allocd;
-  const char *name;
-};
-
-int gimli_slab_init(struct gimli_slab *slab, uint32_t size, const char *name);
-void *gimli_slab_alloc(struct gimli_slab *slab);
-void gimli_slab_destroy(struct gimli_slab *slab);
-
 struct gimli_mapped_object {
-  char *objname;
+  const char *objname;
   int refcnt;
 
   /* primary object for the mapped module */
@@ -256,12 +332,19 @@ struct gimli_mapped_object {
   uint64_t symcount;
   uint64_t symallocd;
   int symchanged;
+  /* set once the ELF symbol tables have been enumerated */
+  int symloaded;
+  /* exported symbols answered from the ELF hash tables without
+   * baking the symtab; symname => gimli_symbol */
+  gimli_hash_t dynsyms;
 
   uint64_t base_addr;
 
-  struct gimli_line_info *lines;
-  uint32_t linecount;
-  uint32_t linealloc;
+  /* .debug_line offset => gimli_line_program, built on first use */
+  gimli_hash_t line_progs;
+  /* decoded line sequences, most recently used first */
+  TAILQ_HEAD(gimli_line_lru, gimli_line_seq) line_lru;
+  uint32_t line_lru_count;
 
   struct dw_fde *fdes;
   uint32_t num_fdes;
@@ -270,6 +353,13 @@ struct gimli_mapped_object {
   struct dw_die_arange *arange;
   uint32_t num_arange;
   uint32_t alloc_arange;
+  int arange_loaded;
+
+  /* variables with static storage, sorted by address; built on
+   * first use */
+  struct dw_die_global *globals;
+  uint32_t num_globals;
+  int globals_built;
 
   /* .debug_info */
   struct {
@@ -280,17 +370,25 @@ struct gimli_mapped_object {
   } debug_info;
   /* .debug_abbrev */
   struct {
-    gimli_hash_t map; /* u64 code => offset to abbr section */
+    gimli_hash_t tables; /* u64 offset + unit header => abbr table */
     gimli_object_file_t elf;
     const uint8_t *start, *end;
   } abbr;
 //  struct gimli_dwarf_die *first_die;
-  struct gimli_slab dieslab, attrslab;
+  struct gimli_slab dieslab, attrslab, exprslab;
 
   gimli_hash_t sections; /* sectname => gimli_section_data */
 
   gimli_type_collection_t types;
   gimli_hash_t die_to_type; /* die-addr => gimli_type_t */
+  /* type name => DIE of its definition, as answered by .debug_names,
+   * .gdb_index, or our own index of the CUs when neither is present */
+  gimli_hash_t type_index;
+  int type_index_built;
+  /* location expression => struct gimli_dwarf_expr */
+  gimli_hash_t exprs;
+  /* location list offset => its parsed ranges */
+  gimli_hash_t loclists;
 };
 
 #ifdef __linux__
@@ -342,6 +440,22 @@ struct gimli_proc {
   gimli_hash_t files;
   /** the primary object for the process */
   gimli_mapped_object_t first_file;
+  /** mapped objects in the order that they were loaded.
+   * References are owned by the files hash */
+  gimli_mapped_object_t *objects;
+  int nobjects;
+  /** alternate names for mapped objects: basename, realpath
+   * and resolved symlinks => gimli_mapped_object_t */
+  gimli_hash_t file_aliases;
+  /** names that resolved to no object, and the value of nobjects
+   * when they were recorded; a new object may resolve them */
+  gimli_hash_t alias_misses;
+  int alias_misses_nobjects;
+  /** when set, gimli_add_object defers reading the ELF data so that
+   * gimli_load_pending_objects can process a batch concurrently */
+  int defer_loads;
+  struct gimli_pending_object *pending;
+  int npending;
   /** address space mappings; maintained in sorted
    * order so that we can bsearch it */
   struct gimli_object_mapping **mappings;
@@ -424,14 +538,20 @@ gimli_mapped_object_t gimli_add_object(
   const char *objname, gimli_addr_t base);
 struct gimli_symbol *gimli_add_symbol(gimli_mapped_object_t f,
   const char *name, gimli_addr_t addr, uint32_t size);
+const char *gimli_symbol_name(struct gimli_symbol *s);
 gimli_mapped_object_t gimli_find_object(
   gimli_proc_t proc,
   const char *objname);
+gimli_mapped_object_t gimli_find_object_by_alias(
+  gimli_proc_t proc,
+  const char *name);
+void gimli_load_pending_objects(gimli_proc_t proc);
 
 #define PTRFMT "0x%" PRIx64
 #define PTRFMT_T uint64_t
 
 int gimli_process_elf(gimli_mapped_object_t f);
+void gimli_elf_load_symbols(gimli_mapped_object_t f);
 int gimli_process_dwarf(gimli_mapped_object_t f);
 int gimli_unwind_next(struct gimli_unwind_cursor *cur);
 int gimli_dwarf_unwind_next(struct gimli_unwind_cursor *cur);
@@ -520,12 +640,40 @@ int dw_eval_expr(struct gimli_unwind_cursor *cur, const uint8_t *ops,
   uint64_t frame_base, uint64_t *result, uint64_t *prepopulate,
   int *is_stack);
 
+/* A location expression, decoded when it is first evaluated.  Nearly
+ * every variable is described by a single operation relative to the
+ * frame base, a register or a fixed address; those shapes are computed
+ * directly and everything else is handed to dw_eval_expr() */
+enum gimli_dwarf_expr_shape {
+  DW_EXPR_GENERIC,
+  DW_EXPR_FBREG,
+  DW_EXPR_BREG,
+  DW_EXPR_REG,
+  DW_EXPR_ADDR,
+  DW_EXPR_CFA
+};
+
+struct gimli_dwarf_expr {
+  const uint8_t *ops;
+  uint64_t oplen;
+  int64_t operand;
+  uint16_t reg;
+  uint8_t shape;
+};
+
+struct gimli_dwarf_expr *dw_compile_expr(gimli_mapped_object_t file,
+  const uint8_t *ops, uint64_t oplen);
+int dw_eval_compiled(struct gimli_unwind_cursor *cur,
+  struct gimli_dwarf_expr *expr, uint64_t frame_base, uint64_t *result,
+  int *is_stack);
+
 struct gimli_dwarf_die *gimli_dwarf_get_die(gimli_mapped_object_t f,
   uint64_t offset);
 
 struct gimli_dwarf_die *gimli_dwarf_get_die_for_pc(gimli_proc_t proc, gimli_addr_t pc);
 struct gimli_dwarf_attr *gimli_dwarf_die_get_attr(
   struct gimli_dwarf_die *die, uint64_t attrcode);
+struct gimli_dwarf_die *gimli_dwarf_die_kids(struct gimli_dwarf_die *die);
 const char *gimli_dwarf_resolve_type_name(gimli_mapped_object_t f,
   struct gimli_dwarf_attr *type);
 int gimli_dwarf_read_value(gimli_proc_t proc, gimli_addr_t addr,
@@ -548,7 +696,17 @@ int dw_calc_location(struct gimli_unwind_cursor *cur,
   uint64_t compilation_unit_base_addr,
   struct gimli_object_mapping *m, uint64_t offset, uint64_t *res,
   gimli_object_file_t elf, int *is_stack);
+int dw_calc_loclist(struct gimli_unwind_cursor *cur,
+  uint64_t compilation_unit_base_addr,
+  struct gimli_object_mapping *m, struct gimli_dwarf_attr *attr,
+  uint64_t *res, int *is_stack);
 void gimli_dwarf_load_all_types(gimli_mapped_object_t file);
+gimli_type_t gimli_dwarf_load_type_by_name(gimli_mapped_object_t file,
+  const char *name);
+gimli_type_t gimli_type_collection_find_interned(
+    gimli_type_collection_t col, const char *key);
+void gimli_type_collection_intern(gimli_type_collection_t col,
+    const char *key, gimli_type_t t);
 
 void gimli_object_file_destroy(gimli_object_file_t obj);
 void gimli_hash_diagnose(gimli_hash_t h);
@@ -568,6 +726,7 @@ gimli_iter_status_t gimli_module_call_var_printer(
     gimli_proc_t proc, gimli_stack_frame_t frame,
     const char *varname, gimli_type_t t,
     gimli_addr_t addr, int depth);
+int gimli_module_wants_var(gimli_type_t t);
 void gimli_show_memory_map(gimli_proc_t proc);
 
 /* ensure that the table size is a power of 2 */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2012 Message Systems, Inc. All rights reserved
+ * For licensing information, see:
+ * https://bitbucket.org/wez/gimli/src/tip/LICENSE
+ */
+#include "impl.h"
+
+/* The intern pool holds a single copy of each distinct string that is
+ * passed to gimli_intern.  Equal strings intern to the same pointer,
+ * so an interned string can be compared by address and used as a
+ * pointer key.  The strings are carved out of chunks that are never
+ * freed; the pool is shared by every process and object that we
+ * look at.  Objects are loaded on several threads at once, so the
+ * pool is guarded by a lock */
+
+struct intern_chunk {
+  struct intern_chunk *next;
+  uint32_t used, size;
+  char data[1];
+};
+
+#define INTERN_CHUNK_SIZE 16384
+
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static gimli_hash_t intern_strings;
+static struct intern_chunk *intern_chunks;
+
+static const char *intern_copy(const char *str)
+{
+  uint32_t len = strlen(str) + 1;
+  struct intern_chunk *c = intern_chunks;
+  char *dest;
+
+  if (!c || c->size - c->used < len) {
+    uint32_t size = len > INTERN_CHUNK_SIZE ? len : INTERN_CHUNK_SIZE;
+
+    c = malloc(sizeof(*c) + size);
+    c->used = 0;
+    c->size = size;
+    c->next = intern_chunks;
+    intern_chunks = c;
+  }
+
+  dest = c->data + c->used;
+  memcpy(dest, str, len);
+  c->used += len;
+  return dest;
+}
+
+const char *gimli_intern(const char *str)
+{
+  const char *res;
+
+  if (!str) return NULL;
+
+  pthread_mutex_lock(&intern_lock);
+  if (!intern_strings) {
+    /* the keys are the interned copies themselves */
+    intern_strings = gimli_hash_new_size(NULL, 0, 0);
+  }
+  if (!gimli_hash_find(intern_strings, str, (void**)&res)) {
+    res = intern_copy(str);
+    gimli_hash_insert(intern_strings, res, (void*)res);
+  }
+  pthread_mutex_unlock(&intern_lock);
+
+  return res;
+}
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -246,9 +246,10 @@ typedef gimli_iter_status_t (*gimli_hash_iter_func_t)(
 typedef void (*gimli_hash_free_func_t)(void *item);
 
 #define GIMLI_HASH_INITIAL_SIZE (1<<7)
-/** duplicate keys when added.  If not set, caller is responsible
- * for ensuring that the key pointer used remains valid for the
- * lifetime of the item in hash */
+/** duplicate keys when added.  The copy stays at the same address
+ * for the lifetime of the item in hash.  If not set, caller is
+ * responsible for ensuring that the key pointer used remains valid
+ * for the lifetime of the item in hash */
 #define GIMLI_HASH_DUP_KEYS   1
 /** keys are treated as pointer values instead of strings */
 #define GIMLI_HASH_PTR_KEYS   2
@@ -78,6 +78,7 @@ static void read_maps(gimli_proc_t proc)
     return;
   }
 
+  proc->defer_loads = 1;
   while (fgets(line, sizeof(line)-1, fp)) {
     int i;
     char *tok = line;
@@ -115,6 +116,7 @@ static void read_maps(gimli_proc_t proc)
     }
   }
   fclose(fp);
+  gimli_load_pending_objects(proc);
 }
 
 int gimli_init_unwind(struct gimli_unwind_cursor *cur,
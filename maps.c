@@ -180,6 +180,98 @@ gimli_mapped_object_t gimli_find_object(
   return NULL;
 }
 
+/* record the alternate names by which a module may refer to an object.
+ * If two objects share an alias, the first one loaded keeps it */
+static void add_object_aliases(gimli_proc_t proc, gimli_mapped_object_t f)
+{
+  char buf[1024];
+  char *real;
+
+  gimli_hash_insert(proc->file_aliases, f->objname, f);
+
+  snprintf(buf, sizeof(buf), "%s", f->objname);
+  gimli_hash_insert(proc->file_aliases, basename(buf), f);
+
+  real = gimli_realpath(f->objname);
+  if (real) {
+    gimli_hash_insert(proc->file_aliases, real, f);
+    free(real);
+  }
+}
+
+/* the object that dir/name resolves to, if any */
+static gimli_mapped_object_t probe_dir_for_symlink(gimli_proc_t proc,
+    const char *dir, const char *name)
+{
+  gimli_mapped_object_t f = NULL;
+  char buf[1024];
+  char *real;
+
+  snprintf(buf, sizeof(buf), "%s/%s", dir, name);
+  real = gimli_realpath(buf);
+  if (!real) {
+    return NULL;
+  }
+  gimli_hash_find(proc->file_aliases, real, (void**)&f);
+  free(real);
+
+  return f;
+}
+
+/* Resolve a module-supplied object name.  It may be the full name,
+ * the basename, or the name of a symlink that lives alongside one
+ * of the loaded objects */
+gimli_mapped_object_t gimli_find_object_by_alias(
+  gimli_proc_t proc,
+  const char *name)
+{
+  gimli_mapped_object_t f = NULL;
+  gimli_hash_t dirs;
+  char buf[1024];
+  const char *dir;
+  int i;
+
+  if (name == NULL) {
+    return proc->first_file;
+  }
+
+  if (gimli_hash_find(proc->file_aliases, name, (void**)&f)) {
+    return f;
+  }
+
+  /* modules tend to ask about the same missing names over and over;
+   * those answers hold until another object is loaded */
+  if (proc->alias_misses_nobjects != proc->nobjects) {
+    gimli_hash_delete_all(proc->alias_misses, 0);
+    proc->alias_misses_nobjects = proc->nobjects;
+  } else if (gimli_hash_find(proc->alias_misses, name, NULL)) {
+    return NULL;
+  }
+
+  /* maybe it refers to a symlink; probe the directories of the
+   * objects in load order, so that the earliest object wins, and
+   * probe each distinct directory only once */
+  dirs = gimli_hash_new(NULL);
+  for (i = 0; i < proc->nobjects && !f; i++) {
+    snprintf(buf, sizeof(buf), "%s", proc->objects[i]->objname);
+    dir = dirname(buf);
+    if (!gimli_hash_insert(dirs, dir, NULL)) {
+      continue;
+    }
+    f = probe_dir_for_symlink(proc, dir, name);
+  }
+  gimli_hash_destroy(dirs);
+
+  if (f) {
+    /* save the mapping */
+    gimli_hash_insert(proc->file_aliases, name, f);
+  } else {
+    gimli_hash_insert(proc->alias_misses, name, NULL);
+  }
+
+  return f;
+}
+
 void gimli_mapped_object_addref(gimli_mapped_object_t file)
 {
   file->refcnt++;
@@ -189,6 +281,8 @@ static void destroy_cu(struct gimli_dwarf_cu *cu)
 {
   if (cu->left) destroy_cu(cu->left);
   if (cu->right) destroy_cu(cu->right);
+  if (cu->die_by_offset) gimli_hash_destroy(cu->die_by_offset);
+  free(cu->scopes);
   free(cu);
 }
 
@@ -202,6 +296,9 @@ void gimli_mapped_object_delete(gimli_mapped_object_t file)
   if (file->symtab) {
     free(file->symtab);
   }
+  if (file->dynsyms) {
+    gimli_hash_destroy(file->dynsyms);
+  }
   if (file->sections) {
     gimli_hash_destroy(file->sections);
   }
@@ -211,8 +308,8 @@ void gimli_mapped_object_delete(gimli_mapped_object_t file)
   if (file->aux_elf) {
     gimli_object_file_destroy(file->aux_elf);
   }
-  if (file->lines) {
-    free(file->lines);
+  if (file->line_progs) {
+    gimli_hash_destroy(file->line_progs);
   }
   if (file->types) {
     gimli_type_collection_delete(file->types);
@@ -220,18 +317,34 @@ void gimli_mapped_object_delete(gimli_mapped_object_t file)
   if (file->die_to_type) {
     gimli_hash_destroy(file->die_to_type);
   }
-  if (file->abbr.map) {
-    gimli_hash_destroy(file->abbr.map);
+  if (file->type_index) {
+    gimli_hash_destroy(file->type_index);
+  }
+  if (file->exprs) {
+    gimli_hash_destroy(file->exprs);
+  }
+  if (file->loclists) {
+    gimli_hash_destroy(file->loclists);
+  }
+  if (file->abbr.tables) {
+    gimli_hash_destroy(file->abbr.tables);
   }
   if (file->debug_info.cus) {
     destroy_cu(file->debug_info.cus);
   }
   free(file->arange);
+  free(file->globals);
   gimli_dw_fde_destroy(file);
+  if (debug) {
+    printf("%s:\n", file->objname);
+    gimli_slab_dump(&file->dieslab);
+    gimli_slab_dump(&file->attrslab);
+    gimli_slab_dump(&file->exprslab);
+  }
   gimli_slab_destroy(&file->dieslab);
   gimli_slab_destroy(&file->attrslab);
+  gimli_slab_destroy(&file->exprslab);
 
-  free(file->objname);
   free(file);
 }
 
@@ -246,10 +359,35 @@ static void destroy_section(void *ptr)
 {
   struct gimli_section_data *data = ptr;
 
-  free(data->name);
   free(data);
 }
 
+/* upper bound on the number of threads used to load objects */
+#define MAX_LOAD_THREADS 8
+
+struct gimli_pending_object {
+  gimli_mapped_object_t file;
+  gimli_addr_t base;
+};
+
+static void load_object(gimli_mapped_object_t f, gimli_addr_t base)
+{
+#ifndef __MACH__
+  f->elf = gimli_elf_open(f->objname);
+  if (f->elf) {
+    f->elf->gobject = f;
+    /* need to determine the base address offset for this object */
+    f->base_addr = (intptr_t)base - f->elf->vaddr;
+    if (debug) {
+      printf("ELF: %s %d base=" PTRFMT " vaddr=" PTRFMT " base_addr=" PTRFMT "\n",
+        f->objname, f->elf->e_type, base, f->elf->vaddr, f->base_addr);
+    }
+
+    gimli_process_elf(f);
+  }
+#endif
+}
+
 gimli_mapped_object_t gimli_add_object(
   gimli_proc_t proc,
   const char *objname, gimli_addr_t base)
@@ -262,10 +400,14 @@ gimli_mapped_object_t gimli_add_object(
 
   f = calloc(1, sizeof(*f));
   f->refcnt = 1;
-  f->objname = strdup(objname);
+  f->objname = gimli_intern(objname);
   f->sections = gimli_hash_new(destroy_section);
-  gimli_slab_init(&f->dieslab, sizeof(struct gimli_dwarf_die), "die");
-  gimli_slab_init(&f->attrslab, sizeof(struct gimli_dwarf_attr), "attr");
+  /* objects with a lot of debug info materialize millions of these */
+  gimli_slab_init_size(&f->dieslab, sizeof(struct gimli_dwarf_die), "die",
+      8192, GIMLI_SLAB_HUGE_PAGE);
+  gimli_slab_init_size(&f->attrslab, sizeof(struct gimli_dwarf_attr), "attr",
+      8192, GIMLI_SLAB_HUGE_PAGE);
+  gimli_slab_init(&f->exprslab, sizeof(struct gimli_dwarf_expr), "expr");
 
   gimli_hash_insert(proc->files, f->objname, f);
 
@@ -273,22 +415,95 @@ gimli_mapped_object_t gimli_add_object(
     proc->first_file = f;
   }
 
-#ifndef __MACH__
-  f->elf = gimli_elf_open(f->objname);
-  if (f->elf) {
-    f->elf->gobject = f;
-    /* need to determine the base address offset for this object */
-    f->base_addr = (intptr_t)base - f->elf->vaddr;
-    if (debug) {
-      printf("ELF: %s %d base=" PTRFMT " vaddr=" PTRFMT " base_addr=" PTRFMT "\n",
-        f->objname, f->elf->e_type, base, f->elf->vaddr, f->base_addr);
+  proc->objects = realloc(proc->objects,
+      (proc->nobjects + 1) * sizeof(*proc->objects));
+  proc->objects[proc->nobjects++] = f;
+  add_object_aliases(proc, f);
+
+  if (proc->defer_loads) {
+    proc->pending = realloc(proc->pending,
+        (proc->npending + 1) * sizeof(*proc->pending));
+    proc->pending[proc->npending].file = f;
+    proc->pending[proc->npending].base = base;
+    proc->npending++;
+  } else {
+    load_object(f, base);
+  }
+
+  return f;
+}
+
+struct load_pool {
+  pthread_mutex_t lock;
+  gimli_proc_t proc;
+  int next;
+};
+
+static void *load_worker(void *arg)
+{
+  struct load_pool *pool = arg;
+  struct gimli_pending_object *p;
+
+  while (1) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->next >= pool->proc->npending) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
     }
+    p = &pool->proc->pending[pool->next++];
+    pthread_mutex_unlock(&pool->lock);
 
-    gimli_process_elf(f);
+    load_object(p->file, p->base);
   }
+  return NULL;
+}
+
+/* Reads the ELF data for the objects that were added while
+ * proc->defer_loads was set.  Opening an object and probing for its
+ * debug file touches only that object, so the batch is spread over a
+ * small pool of threads; the caller resumes once every object in the
+ * batch has been loaded */
+void gimli_load_pending_objects(gimli_proc_t proc)
+{
+  struct load_pool pool;
+  pthread_t threads[MAX_LOAD_THREADS];
+  int nthreads = 1, i;
+
+  proc->defer_loads = 0;
+  if (!proc->npending) {
+    return;
+  }
+
+#ifdef _SC_NPROCESSORS_ONLN
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
 #endif
+  if (nthreads > MAX_LOAD_THREADS) {
+    nthreads = MAX_LOAD_THREADS;
+  }
+  if (nthreads > proc->npending) {
+    nthreads = proc->npending;
+  }
 
-  return f;
+  memset(&pool, 0, sizeof(pool));
+  pthread_mutex_init(&pool.lock, NULL);
+  pool.proc = proc;
+
+  /* the calling thread is one of the workers */
+  for (i = 1; i < nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, load_worker, &pool)) {
+      break;
+    }
+  }
+  nthreads = i;
+  load_worker(&pool);
+  for (i = 1; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_mutex_destroy(&pool.lock);
+
+  free(proc->pending);
+  proc->pending = NULL;
+  proc->npending = 0;
 }
 
 
@@ -5,13 +5,107 @@
  */
 #include "impl.h"
 
-static gimli_hash_t derefd = NULL;
 static int max_depth = 4;
 static int max_arr = 16;
 
 static char indentstr[] =
 "                                                                      ";
 
+/* The structs that have been printed, by type and address, so that
+ * each is expanded only once.  This is an open addressed set of fixed
+ * size keys, probed linearly; it holds at most MAX_DEREFD of them */
+struct deref_key {
+  gimli_type_t type;
+  gimli_addr_t addr;
+};
+
+struct deref_set {
+  struct deref_key *keys;
+  /* number of slots; a power of 2 */
+  uint32_t size;
+  uint32_t used;
+};
+
+static struct deref_set derefd;
+
+#define DEREFD_INITIAL_SIZE 1024
+#define MAX_DEREFD (1 << 20)
+
+static uint32_t deref_hash(gimli_type_t t, gimli_addr_t addr)
+{
+  uint64_t h = ((uint64_t)(uintptr_t)t * 0x9e3779b97f4a7c15ULL) ^ addr;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return (uint32_t)h;
+}
+
+/* returns the slot holding the key, or the empty slot where it goes */
+static struct deref_key *deref_slot(gimli_type_t t, gimli_addr_t addr)
+{
+  uint32_t mask = derefd.size - 1;
+  uint32_t i = deref_hash(t, addr) & mask;
+
+  while (derefd.keys[i].type &&
+      (derefd.keys[i].type != t || derefd.keys[i].addr != addr)) {
+    i = (i + 1) & mask;
+  }
+  return &derefd.keys[i];
+}
+
+static int deref_grow(void)
+{
+  struct deref_key *old = derefd.keys;
+  uint32_t oldsize = derefd.size, i;
+
+  derefd.size = oldsize ? oldsize * 2 : DEREFD_INITIAL_SIZE;
+  derefd.keys = calloc(derefd.size, sizeof(*derefd.keys));
+  if (!derefd.keys) {
+    derefd.keys = old;
+    derefd.size = oldsize;
+    return 0;
+  }
+  for (i = 0; i < oldsize; i++) {
+    if (old[i].type) {
+      *deref_slot(old[i].type, old[i].addr) = old[i];
+    }
+  }
+  free(old);
+  return 1;
+}
+
+static int deref_seen(gimli_type_t t, gimli_addr_t addr)
+{
+  if (!derefd.used) {
+    return 0;
+  }
+  return deref_slot(t, addr)->type != NULL;
+}
+
+/* records the key; returns 0 if there is no room for it */
+static int deref_add(gimli_type_t t, gimli_addr_t addr)
+{
+  struct deref_key *k;
+
+  if (derefd.used >= MAX_DEREFD) {
+    return 0;
+  }
+  /* keep the set no more than half full */
+  if ((derefd.used + 1) * 2 > derefd.size && !deref_grow()) {
+    return 0;
+  }
+  k = deref_slot(t, addr);
+  if (!k->type) {
+    k->type = t;
+    k->addr = addr;
+    derefd.used++;
+  }
+  return 1;
+}
+
 struct print_data {
   gimli_proc_t proc;
   gimli_stack_frame_t frame;
@@ -34,6 +128,60 @@ struct print_data {
 
 static int print_var(struct print_data *data, gimli_type_t t, const char *varname);
 
+/* Structs and arrays are read from the target in one go and their
+ * members are rendered from that local copy, held in data->mem.
+ * Anything larger than this is read a member at a time */
+#define MAX_SNAPSHOT 65536
+
+/* returns the local copy of len bytes at addr, if the copy of the
+ * enclosing aggregate covers them */
+static void *local_copy(struct print_data *data, gimli_addr_t addr,
+    uint64_t len)
+{
+  gimli_addr_t base;
+
+  if (!data->mem) {
+    return NULL;
+  }
+  base = gimli_mem_ref_target(data->mem);
+  if (addr < base || addr + len > base + gimli_mem_ref_size(data->mem)) {
+    return NULL;
+  }
+  return (char*)gimli_mem_ref_local(data->mem) + (addr - base);
+}
+
+/* reads len bytes at addr, from the local copy if there is one,
+ * otherwise from the target */
+static int read_data(struct print_data *data, gimli_addr_t addr,
+    void *buf, uint64_t len)
+{
+  void *local = local_copy(data, addr, len);
+
+  if (local) {
+    memcpy(buf, local, len);
+    return len;
+  }
+  return gimli_read_mem(data->proc, addr, buf, len);
+}
+
+/* reads len bytes at addr into a local copy for the members of an
+ * aggregate to be rendered from.  Returns NULL if the enclosing copy
+ * already covers them, or if they are too large or can't be read, in
+ * which case the members are read individually */
+static gimli_mem_ref_t snapshot(struct print_data *data, gimli_addr_t addr,
+    uint64_t len)
+{
+  gimli_mem_ref_t ref;
+
+  if (len == 0 || len > MAX_SNAPSHOT || local_copy(data, addr, len)) {
+    return NULL;
+  }
+  if (gimli_proc_mem_ref(data->proc, addr, len, &ref) != GIMLI_ERR_OK) {
+    return NULL;
+  }
+  return ref;
+}
+
 static void print_quoted_string(gimli_proc_t proc, gimli_addr_t addr)
 {
   gimli_mem_ref_t ref;
@@ -99,7 +247,7 @@ static gimli_iter_status_t print_member(const char *name,
   return GIMLI_ITER_CONT;
 }
 
-static void print_float(gimli_proc_t proc,
+static void print_float(struct print_data *data,
     gimli_type_t t, gimli_addr_t addr,
     uint64_t offset, uint64_t bits)
 {
@@ -115,7 +263,7 @@ static void print_float(gimli_proc_t proc,
 
   addr += (offset / 8);
 
-  if (gimli_read_mem(proc, addr, &u.f, bytes) != bytes) {
+  if (read_data(data, addr, &u.f, bytes) != bytes) {
     printf("<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
       bytes, addr);
     return;
@@ -137,7 +285,7 @@ static void print_float(gimli_proc_t proc,
   }
 }
 
-static void print_enum(gimli_proc_t proc,
+static void print_enum(struct print_data *data,
     gimli_type_t t, gimli_addr_t addr,
     uint64_t offset, uint64_t bits)
 {
@@ -155,7 +303,7 @@ static void print_enum(gimli_proc_t proc,
   addr += (offset / 8);
   u.u64 = 0;
 
-  if (gimli_read_mem(proc, addr, &u.u64, bytes) != bytes) {
+  if (read_data(data, addr, &u.u64, bytes) != bytes) {
     printf("<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
         bytes, addr);
     return;
@@ -185,7 +333,6 @@ static void print_enum(gimli_proc_t proc,
 }
 
 static void print_integer(struct print_data *data,
-    gimli_proc_t proc,
     gimli_type_t t, gimli_addr_t addr,
     uint64_t offset, uint64_t bits)
 {
@@ -233,7 +380,7 @@ static void print_integer(struct print_data *data,
       printf("??? <invalid bitfield size %" PRIu64 ">", bits);
       return;
     }
-    if (gimli_read_mem(proc, addr, &u.u64, bytes) != bytes) {
+    if (read_data(data, addr, &u.u64, bytes) != bytes) {
       printf("<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
         bytes, addr);
       return;
@@ -245,7 +392,7 @@ static void print_integer(struct print_data *data,
 
     bytes = 8;
 
-  } else if (gimli_read_mem(proc, addr, &u.u64, bytes) != bytes) {
+  } else if (read_data(data, addr, &u.u64, bytes) != bytes) {
     printf("<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
         bytes, addr);
     return;
@@ -291,6 +438,99 @@ static void print_integer(struct print_data *data,
   }
 }
 
+static char *format_dec(char *p, int64_t val)
+{
+  char digits[24], *d = digits + sizeof(digits);
+  uint64_t v = val < 0 ? -(uint64_t)val : (uint64_t)val;
+
+  do {
+    *--d = '0' + (v % 10);
+    v /= 10;
+  } while (v);
+  if (val < 0) {
+    *p++ = '-';
+  }
+  memcpy(p, d, digits + sizeof(digits) - d);
+  return p + (digits + sizeof(digits) - d);
+}
+
+static char *format_hex(char *p, uint64_t val)
+{
+  static const char hexdigits[] = "0123456789abcdef";
+  char digits[16], *d = digits + sizeof(digits);
+
+  do {
+    *--d = hexdigits[val & 0xf];
+    val >>= 4;
+  } while (val);
+  *p++ = '0';
+  *p++ = 'x';
+  memcpy(p, d, digits + sizeof(digits) - d);
+  return p + (digits + sizeof(digits) - d);
+}
+
+/* Renders a run of n array elements of integer type t, each bytes
+ * wide, from their local copy in buf.  The output matches that of
+ * print_integer for array elements, but is built up locally and
+ * written in a few large pieces rather than through printf */
+static void print_integer_run(gimli_type_t t, const uint8_t *buf,
+    uint32_t n, uint32_t bytes)
+{
+  struct gimli_type_encoding enc;
+  char out[4096], *p = out;
+  uint64_t val;
+  union {
+    uint64_t u64;
+    uint32_t u32;
+    uint16_t u16;
+  } u;
+  uint32_t i;
+  int is_signed;
+
+  gimli_type_encoding(t, &enc);
+  is_signed = enc.format & GIMLI_INT_SIGNED;
+
+  for (i = 0; i < n; i++, buf += bytes) {
+    /* room for a separator and the longest number */
+    if (p - out > sizeof(out) - 32) {
+      fwrite(out, 1, p - out, stdout);
+      p = out;
+    }
+    if (i) {
+      *p++ = ',';
+      *p++ = ' ';
+    }
+
+    switch (bytes) {
+      case 1:
+        val = *buf;
+        break;
+      case 2:
+        memcpy(&u.u16, buf, 2);
+        val = u.u16;
+        break;
+      case 4:
+        memcpy(&u.u32, buf, 4);
+        val = u.u32;
+        break;
+      default:
+        memcpy(&u.u64, buf, 8);
+        val = u.u64;
+    }
+
+    if (!is_signed) {
+      p = format_hex(p, val);
+    } else if (bytes == 4) {
+      p = format_dec(p, (int32_t)val);
+    } else {
+      /* as with print_integer, values narrower than an int are
+       * rendered without sign extension */
+      p = format_dec(p, (int64_t)val);
+    }
+  }
+  fwrite(out, 1, p - out, stdout);
+}
+
 static void print_array(struct print_data *sdata, gimli_type_t t)
 {
   struct gimli_type_encoding enc;
@@ -304,6 +544,9 @@ static void print_array(struct print_data *sdata, gimli_type_t t)
   struct print_data data = *sdata;
   int is_struct;
   gimli_type_t target;
+  gimli_mem_ref_t ref;
+  uint32_t nelems, bytes;
+  void *local;
 
   if (!gimli_type_arinfo(t, &arinfo)) {
     printf("not an array type in print_array!?\n");
@@ -367,20 +610,42 @@ static void print_array(struct print_data *sdata, gimli_type_t t)
   data.terse = 1;
   data.in_array++;
 
-  for (i = 0; i < arinfo.nelems && i < max_arr; i++) {
-    data.depth = depth + 1;
-    data.addr = addr + (i * (data.size / 8));
+  nelems = arinfo.nelems < max_arr ? arinfo.nelems : max_arr;
+  bytes = data.size / 8;
+  ref = snapshot(&data, addr, (uint64_t)nelems * bytes);
+  if (ref) {
+    data.mem = ref;
+  }
 
-    if (i) {
-      if (is_struct) {
-        printf("\n%.*s,\n%.*s",
-            (depth + 2) * 4, indentstr,
-            (depth + 2) * 4, indentstr);
-      } else {
-        printf(", ");
+  local = NULL;
+  if (gimli_type_kind(target) == GIMLI_K_INTEGER &&
+      (data.size == 8 || data.size == 16 ||
+       data.size == 32 || data.size == 64) &&
+      (!data.frame || !gimli_module_wants_var(target))) {
+    local = local_copy(&data, addr, (uint64_t)nelems * bytes);
+  }
+
+  if (local) {
+    print_integer_run(target, local, nelems, bytes);
+  } else {
+    for (i = 0; i < nelems; i++) {
+      data.depth = depth + 1;
+      data.addr = addr + (i * bytes);
+
+      if (i) {
+        if (is_struct) {
+          printf("\n%.*s,\n%.*s",
+              (depth + 2) * 4, indentstr,
+              (depth + 2) * 4, indentstr);
+        } else {
+          printf(", ");
+        }
       }
+      print_var(&data, target, "");
     }
-    print_var(&data, target, "");
+  }
+  if (ref) {
+    gimli_mem_ref_delete(ref);
   }
   if (arinfo.nelems > max_arr) {
     printf(" ...");
@@ -398,18 +663,17 @@ static void print_pointer(struct print_data *data, gimli_type_t t)
   gimli_addr_t addr = data->addr + (data->offset / 8);
   gimli_addr_t addrsave = data->addr;
   int depth = data->depth;
-  char addrkey[64];
   char namebuf[1024];
   const char *symname;
   struct print_data savdata = *data;
+  gimli_mem_ref_t ref;
 
   if (data->addr == 0) {
     printf("nil");
     return;
   }
 
-  if (gimli_read_mem(data->proc, addr, &tptr,
-        sizeof(tptr)) != sizeof(tptr)) {
+  if (read_data(data, addr, &tptr, sizeof(tptr)) != sizeof(tptr)) {
     printf("<unable to read %" PRIu32 " bytes at " PTRFMT ">",
         (uint32_t)sizeof(ptr), data->addr);
     return;
@@ -465,14 +729,17 @@ static void print_pointer(struct print_data *data, gimli_type_t t)
     return;
   }
 
-  snprintf(addrkey, sizeof(addrkey), "%p:%" PRIx64, target, data->addr);
-  if (gimli_hash_find(derefd, addrkey, &dummy)) {
+  if (deref_seen(target, data->addr)) {
     printf(" " PTRFMT " [deref'd above]", ptr);
     return;
   }
 
   printf(PTRFMT " [deref'ing]\n", ptr);
 
+  /* we're going to render the target, so read it in one go and let
+   * its members be rendered from the local copy */
+  ref = snapshot(data, ptr, gimli_type_size(target) / 8);
+
   data->show_decl = 1;
   data->prefix = " = ";
   data->suffix = "\n";
@@ -481,10 +748,16 @@ static void print_pointer(struct print_data *data, gimli_type_t t)
   data->addr = (gimli_addr_t)ptr;
   data->offset = 0;
   data->size = gimli_type_size(target);
+  if (ref) {
+    data->mem = ref;
+  }
 
   print_var(data, target, NULL);
 
   *data = savdata;
+  if (ref) {
+    gimli_mem_ref_delete(ref);
+  }
 }
 
 static gimli_iter_status_t after_print_var(
@@ -520,8 +793,6 @@ static int print_var(struct print_data *data, gimli_type_t t, const char *varnam
 {
   int indent = 4 * (data->depth + 1);
   gimli_addr_t addr;
-  char addrkey[64];
-  void *dummy;
 
   if (data->frame) {
 
@@ -556,12 +827,11 @@ static int print_var(struct print_data *data, gimli_type_t t, const char *varnam
     switch (gimli_type_kind(t)) {
       case GIMLI_K_UNION:
       case GIMLI_K_STRUCT:
-        snprintf(addrkey, sizeof(addrkey), "%p:%" PRIx64, t, addr);
-        if (gimli_hash_find(derefd, addrkey, &dummy)) {
+        if (deref_seen(t, addr)) {
           printf(" " PTRFMT " [deref'd above]\n", addr);
           return GIMLI_ITER_CONT;
         }
-        if (!gimli_hash_insert(derefd, addrkey, NULL)) {
+        if (!deref_add(t, addr)) {
           printf(" " PTRFMT " <hash insert failed>\n", addr);
           return GIMLI_ITER_CONT;
         }
@@ -569,21 +839,30 @@ static int print_var(struct print_data *data, gimli_type_t t, const char *varnam
         printf(" " PTRFMT " = {\n", addr);
         {
           struct print_data d = *data;
+          gimli_mem_ref_t ref;
+
           d.depth++;
           d.addr = addr;
           d.offset = 0;
+          ref = snapshot(&d, addr, gimli_type_size(t) / 8);
+          if (ref) {
+            d.mem = ref;
+          }
           gimli_type_member_visit(t, print_member, &d);
+          if (ref) {
+            gimli_mem_ref_delete(ref);
+          }
         }
         printf("%.*s}\n", indent, indentstr);
         break;
       case GIMLI_K_INTEGER:
         printf("%s", data->prefix);
-        print_integer(data, data->proc, t, data->addr, data->offset, data->size);
+        print_integer(data, t, data->addr, data->offset, data->size);
         printf("%s", data->suffix);
         break;
       case GIMLI_K_FLOAT:
         printf("%s", data->prefix);
-        print_float(data->proc, t, data->addr, data->offset, data->size);
+        print_float(data, t, data->addr, data->offset, data->size);
         printf("%s", data->suffix);
         break;
       case GIMLI_K_POINTER:
@@ -593,7 +872,7 @@ static int print_var(struct print_data *data, gimli_type_t t, const char *varnam
         break;
       case GIMLI_K_ENUM:
         printf("%s", data->prefix);
-        print_enum(data->proc, t, data->addr, data->offset, data->size);
+        print_enum(data, t, data->addr, data->offset, data->size);
         printf("%s", data->suffix);
         break;
       case GIMLI_K_ARRAY:
@@ -638,10 +917,8 @@ static gimli_iter_status_t show_var(
 
 static void tidy_deref(void)
 {
-  if (derefd) {
-    gimli_hash_destroy(derefd);
-    derefd = NULL;
-  }
+  free(derefd.keys);
+  memset(&derefd, 0, sizeof(derefd));
 }
 
 int gimli_print_addr_as_type(gimli_proc_t proc,
@@ -697,8 +974,7 @@ void gimli_render_frame(int tid, int nframe, gimli_stack_frame_t frame)
     data.prefix = " = ";
     data.suffix = "\n";
 
-    if (!derefd) {
-      derefd = gimli_hash_new(NULL);
+    if (!derefd.keys && deref_grow()) {
       atexit(tidy_deref);
     }
 
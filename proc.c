@@ -24,6 +24,9 @@ void gimli_proc_delete(gimli_proc_t proc)
 
     free(thr);
   }
+  gimli_hash_destroy(proc->file_aliases);
+  gimli_hash_destroy(proc->alias_misses);
+  free(proc->objects);
   gimli_hash_destroy(proc->files);
 
   for (i = 0; i < proc->nmaps; i++) {
@@ -107,6 +110,8 @@ gimli_err_t gimli_proc_attach(int pid, gimli_proc_t *proc)
   p->pid = pid;
   STAILQ_INIT(&p->threads);
   p->files = gimli_hash_new(gimli_destroy_mapped_object_hash);
+  p->file_aliases = gimli_hash_new(NULL);
+  p->alias_misses = gimli_hash_new(NULL);
 
   err = gimli_attach(p);
 
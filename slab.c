@@ -5,32 +5,127 @@
  */
 #include "impl.h"
 
-#define SLAB_SIZE 8000
-//1024*8000
+#define SLAB_SIZE 8192
+
+#ifndef MAP_ANON
+# define MAP_ANON MAP_ANONYMOUS
+#endif
 
 int gimli_slab_init(struct gimli_slab *slab, uint32_t size, const char *name)
 {
+  return gimli_slab_init_size(slab, size, name, SLAB_SIZE, SLAB_SIZE);
+}
+
+/* Pages start out page_size bytes long and each new page is twice the
+ * size of the last, up to max_page_size.  Pages of GIMLI_SLAB_HUGE_PAGE
+ * bytes or more are mapped directly and, where the system supports it,
+ * backed by huge pages */
+int gimli_slab_init_size(struct gimli_slab *slab, uint32_t size,
+    const char *name, size_t page_size, size_t max_page_size)
+{
+  memset(slab, 0, sizeof(*slab));
   LIST_INIT(&slab->pages);
   slab->name = name;
-  slab->total_allocd = 0;
-  slab->per_page = (SLAB_SIZE - sizeof(struct gimli_slab_page)) / size;
+
+  size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
   slab->item_size = size;
-  slab->next_avail = 0;
+
+  slab->base_page_size = page_size;
+  slab->page_size = page_size;
+  slab->max_page_size = max_page_size < page_size ? page_size : max_page_size;
+  slab->per_page = (page_size - sizeof(struct gimli_slab_page)) / size;
 //  printf("slab_init: per_page=%d of %d each\n", slab->per_page, slab->item_size);
 
   return 1;
 }
 
+static struct gimli_slab_page *new_page(struct gimli_slab *slab, size_t size)
+{
+  struct gimli_slab_page *p = NULL;
+
+  if (size >= GIMLI_SLAB_HUGE_PAGE) {
+    /* over-allocate so that the page can be aligned to a huge page
+     * boundary, then give back the ends */
+    size_t len = size + GIMLI_SLAB_HUGE_PAGE;
+    uintptr_t start, aligned;
+    void *m;
+
+    m = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    if (m != MAP_FAILED) {
+      start = (uintptr_t)m;
+      aligned = (start + GIMLI_SLAB_HUGE_PAGE - 1) &
+        ~((uintptr_t)GIMLI_SLAB_HUGE_PAGE - 1);
+      if (aligned > start) {
+        munmap(m, aligned - start);
+      }
+      if (start + len > aligned + size) {
+        munmap((void*)(aligned + size), (start + len) - (aligned + size));
+      }
+#ifdef MADV_HUGEPAGE
+      madvise((void*)aligned, size, MADV_HUGEPAGE);
+#endif
+      p = (struct gimli_slab_page*)aligned;
+      p->mapped = 1;
+    }
+  }
+  if (!p) {
+    p = malloc(size);
+    if (!p) return NULL;
+    p->mapped = 0;
+  }
+  p->size = size;
+
+  slab->npages++;
+  slab->page_bytes += size;
+  return p;
+}
+
+static void free_page(struct gimli_slab_page *p)
+{
+  if (p->mapped) {
+    munmap(p, p->size);
+  } else {
+    free(p);
+  }
+}
+
 void *gimli_slab_alloc(struct gimli_slab *slab)
+{
+  return gimli_slab_alloc_array(slab, 1);
+}
+
+/* allocate n contiguous items.  A run too large for a page gets a
+ * page of its own, placed behind the current page so that the
+ * current page continues to be filled */
+void *gimli_slab_alloc_array(struct gimli_slab *slab, uint32_t n)
 {
   struct gimli_slab_page *p;
   uint8_t *item;
 
-//  return malloc(slab->item_size);
+  if (n > slab->per_page) {
+    p = new_page(slab, sizeof(*p) + ((size_t)slab->item_size * n));
+    if (!p) return NULL;
+    if (LIST_FIRST(&slab->pages)) {
+      LIST_INSERT_AFTER(LIST_FIRST(&slab->pages), p, list);
+    } else {
+      LIST_INSERT_HEAD(&slab->pages, p, list);
+      slab->next_avail = slab->per_page;
+    }
+    slab->total_allocd += n;
+    return p + 1;
+  }
 
-  if (slab->next_avail + 1 >= slab->per_page || !LIST_FIRST(&slab->pages)) {
-    /* need a new page */
-    p = malloc(SLAB_SIZE);
+  if (slab->next_avail + n > slab->per_page || !LIST_FIRST(&slab->pages)) {
+    /* need a new page; whatever is left of the current one is lost */
+    if (LIST_FIRST(&slab->pages)) {
+      slab->wasted += (uint64_t)(slab->per_page - slab->next_avail) *
+        slab->item_size;
+      if (slab->page_size < slab->max_page_size) {
+        slab->page_size *= 2;
+        slab->per_page = (slab->page_size - sizeof(*p)) / slab->item_size;
+      }
+    }
+    p = new_page(slab, slab->page_size);
     if (!p) return NULL;
     LIST_INSERT_HEAD(&slab->pages, p, list);
     slab->next_avail = 0;
@@ -38,8 +133,9 @@ void *gimli_slab_alloc(struct gimli_slab *slab)
   }
 
   p = LIST_FIRST(&slab->pages);
-  item = (uint8_t*)(p + 1) + (slab->item_size * slab->next_avail++);
-  slab->total_allocd++;
+  item = (uint8_t*)(p + 1) + (slab->item_size * slab->next_avail);
+  slab->next_avail += n;
+  slab->total_allocd += n;
 #if 0
   printf("now %" PRIu32 " objects of size %" PRIu32 " via slab %p %s\n",
       slab->total_allocd, slab->item_size, slab, slab->name);
@@ -47,19 +143,41 @@ void *gimli_slab_alloc(struct gimli_slab *slab)
   return item;
 }
 
-void gimli_slab_destroy(struct gimli_slab *slab)
+/* release every page at once; the slab may be used again afterwards */
+void gimli_slab_reset(struct gimli_slab *slab)
 {
   struct gimli_slab_page *p;
 
   while (LIST_FIRST(&slab->pages)) {
     p = LIST_FIRST(&slab->pages);
     LIST_REMOVE(p, list);
-    free(p);
+    free_page(p);
   }
   slab->next_avail = 0;
+  slab->total_allocd = 0;
+  slab->npages = 0;
+  slab->page_bytes = 0;
+  slab->wasted = 0;
+  slab->page_size = slab->base_page_size;
+  slab->per_page = (slab->page_size - sizeof(*p)) / slab->item_size;
 }
 
+void gimli_slab_destroy(struct gimli_slab *slab)
+{
+  gimli_slab_reset(slab);
+}
+
+void gimli_slab_dump(struct gimli_slab *slab)
+{
+  printf("slab %s: item=%" PRIu32 " pages=%" PRIu64 " bytes=%" PRIu64
+      " live=%" PRIu32 " occupancy=%.0f%% waste=%" PRIu64 "\n",
+      slab->name, slab->item_size, slab->npages, slab->page_bytes,
+      slab->total_allocd,
+      slab->page_bytes ?
+        (double)slab->total_allocd * slab->item_size /
+        (double)slab->page_bytes * 100.0 : 0.0,
+      slab->wasted);
+}
 
 /* vim:ts=2:sw=2:et:
  */
-
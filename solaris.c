@@ -187,6 +187,7 @@ static void read_maps(gimli_proc_t proc)
   close(fd);
   end = maps + (sb.st_size / sizeof(*m));
 
+  proc->defer_loads = 1;
   for (m = maps; m < end; m++) {
     /* the mapname is the name of a symlink in /proc/pid/path;
      * we need to resolve that link and add the mapping */
@@ -201,6 +202,7 @@ static void read_maps(gimli_proc_t proc)
       gimli_add_mapping(proc, target, m->pr_vaddr, m->pr_size, m->pr_offset);
     }
   }
+  gimli_load_pending_objects(proc);
 
   free(maps);
 }
@@ -5,11 +5,53 @@
  */
 #include "impl.h"
 
+/* Demangled names are computed on demand and shared across objects;
+ * mangled name => demangled name.  Both live in the intern pool, as
+ * the cache itself is never freed */
+static gimli_hash_t demangle_cache;
+
+static int is_mangled(const char *name)
+{
+#ifdef __MACH__
+  /* skip leading '_' that is present on this platform */
+  if (*name++ != '_') return 0;
+#endif
+  return name[0] == '_' && name[1] == 'Z';
+}
+
+/* Returns the demangled name of a symbol, demangling it the first
+ * time that it is needed */
+const char *gimli_symbol_name(struct gimli_symbol *s)
+{
+  char buf[1024];
+  const char *name;
+
+  if (s->name != s->rawname || !is_mangled(s->rawname)) {
+    return s->name;
+  }
+
+  if (!demangle_cache) {
+    demangle_cache = gimli_hash_new_size(NULL, 0, 0);
+  }
+  if (!gimli_hash_find(demangle_cache, s->rawname, (void**)&name)) {
+    /* the key must outlive the object that owns rawname */
+    const char *key = gimli_intern(s->rawname);
+
+    if (gimli_demangle(s->rawname, buf, sizeof(buf))) {
+      name = gimli_intern(buf);
+    } else {
+      name = key;
+    }
+    gimli_hash_insert(demangle_cache, key, (void*)name);
+  }
+  s->name = name;
+  return name;
+}
+
 struct gimli_symbol *gimli_add_symbol(gimli_mapped_object_t f,
   const char *name, gimli_addr_t addr, uint32_t size)
 {
   struct gimli_symbol *s;
-  char buf[1024];
 
   if (f->symcount + 1 >= f->symallocd) {
     f->symallocd = f->symallocd ? f->symallocd * 2 : 1024;
@@ -21,12 +63,9 @@ struct gimli_symbol *gimli_add_symbol(gimli_mapped_object_t f,
   memset(s, 0, sizeof(*s));
 
   s->rawname = name;//strdup(name);
+  /* demangled lazily by gimli_symbol_name */
   s->name = s->rawname;
 
-  if (gimli_demangle(s->rawname, buf, sizeof(buf))) {
-    s->name = strdup(buf);
-  }
-
   s->addr = addr;
   s->size = size;
 
@@ -65,6 +104,12 @@ static void bake_symtab(gimli_mapped_object_t f)
   int i, j;
   struct gimli_symbol *s;
 
+#ifndef __MACH__
+  if (!f->symloaded) {
+    f->symloaded = 1;
+    gimli_elf_load_symbols(f);
+  }
+#endif
   if (!f->symchanged) return;
   f->symchanged = 0;
 
@@ -185,11 +230,11 @@ struct gimli_symbol *find_symbol_for_addr(gimli_mapped_object_t f,
 
   /* best available */
   best = csym;
-  bu = calc_readability(best->name);
+  bu = calc_readability(gimli_symbol_name(best));
   csym++;
 
   while (csym <= last) {
-    cu = calc_readability(csym->name);
+    cu = calc_readability(gimli_symbol_name(csym));
     if (cu < bu) {
       /* this one is better */
       best = csym;
@@ -216,40 +261,6 @@ static struct gimli_symbol *sym_lookup(gimli_mapped_object_t file,
   return NULL;
 }
 
-struct find_sym {
-  const char *name;
-  gimli_mapped_object_t file;
-  struct gimli_symbol *sym;
-};
-
-static gimli_iter_status_t search_for_sym(const char *k, int klen,
-    void *item, void *arg)
-{
-  gimli_mapped_object_t file = item;
-  struct find_sym *find = arg;
-
-  find->sym = sym_lookup(file, find->name);
-  if (find->sym) return GIMLI_ITER_STOP;
-
-  return GIMLI_ITER_CONT;
-}
-
-static gimli_iter_status_t search_for_basename(const char *k, int klen,
-    void *item, void *arg)
-{
-  gimli_mapped_object_t file = item;
-  struct find_sym *find = arg;
-  char buf[1024];
-
-  strcpy(buf, file->objname);
-  if (!strcmp(basename(buf), find->name)) {
-    find->file = file;
-    return GIMLI_ITER_STOP;
-  }
-
-  return GIMLI_ITER_CONT;
-}
-
 /* This function always returns a buffer that needs to
  * be released via free(3).  We use the native feature
  * of the system libc if we know it is present, otherwise
@@ -288,74 +299,102 @@ char *gimli_realpath(const char *filename)
 #endif
 }
 
-static gimli_iter_status_t search_for_symlink(const char *k, int klen,
-    void *item, void *arg)
+#ifndef __MACH__
+/* Fast path for exported symbols: consult the .gnu.hash or .hash
+ * table of the object rather than sorting and hashing the complete
+ * symbol table.  Returns NULL if the name is not exported, in which
+ * case the caller should fall back to the full symbol table */
+static struct gimli_symbol *dynsym_lookup(gimli_mapped_object_t f,
+    const char *name)
 {
-  gimli_mapped_object_t file = item;
-  struct find_sym *find = arg;
-  char dir[1024];
-  char buf[1024];
-  char *real;
-  int len;
-  gimli_iter_status_t status = GIMLI_ITER_CONT;
+  struct gimli_elf_symbol esym;
+  struct gimli_symbol *s = NULL;
 
-  strcpy(dir, file->objname);
-  snprintf(buf, sizeof(buf)-1, "%s/%s", dirname(dir), find->name);
-  real = gimli_realpath(buf);
-  if (!real) {
-    return GIMLI_ITER_CONT;
+  if (!f->elf) {
+    return NULL;
+  }
+  if (f->dynsyms && gimli_hash_find(f->dynsyms, name, (void**)&s)) {
+    return s;
+  }
+  if (!gimli_elf_lookup_dynsym(f->elf, name, &esym)) {
+    return NULL;
+  }
+  /* same filtering as for_each_symbol in elf.c, so that a name
+   * resolves here only if the full symbol table would also have it */
+  if (!esym.st_size || !esym.name[0] || strchr(esym.name, '.') ||
+      strchr(esym.name, '$')) {
+    return NULL;
   }
 
-  if (!strcmp(real, file->objname)) {
-    status = GIMLI_ITER_STOP;
-    find->file = file;
+  s = calloc(1, sizeof(*s));
+  s->rawname = esym.name;
+  s->name = s->rawname;
+  s->addr = esym.st_value + f->base_addr;
+  s->size = esym.st_size;
+
+  if (!f->dynsyms) {
+    f->dynsyms = gimli_hash_new_size(free, 0, 16);
   }
+  /* key is owned by the dynstr section data */
+  gimli_hash_insert(f->dynsyms, s->rawname, s);
+
+  return s;
+}
+#else
+# define dynsym_lookup(f, name) NULL
+#endif
 
-  free(real);
+/* The definition of name within a single object: exported names are
+ * answered from the ELF hash tables, anything else needs the full
+ * symbol table of that object */
+static struct gimli_symbol *object_sym_lookup(gimli_mapped_object_t f,
+    const char *name)
+{
+  struct gimli_symbol *sym;
 
-  return status;
+  sym = dynsym_lookup(f, name);
+  if (!sym) {
+    sym = sym_lookup(f, name);
+  }
+  return sym;
 }
 
 struct gimli_symbol *gimli_sym_lookup(gimli_proc_t proc, const char *obj, const char *name)
 {
   gimli_mapped_object_t f;
   struct gimli_symbol *sym = NULL;
-  struct find_sym find;
 
-  find.name = name;
-
-  /* if obj is NULL, we're looking for it anywhere we can find it */
+  /* if obj is NULL, we're looking for it anywhere we can find it.
+   * Objects are tried in the order that they were loaded, so that the
+   * first definition of a name wins, matching the runtime linker; a
+   * local or static definition in an earlier object still beats a
+   * later object's export, and the full symbol tables of the later
+   * objects are never read */
   if (obj == NULL) {
-    gimli_hash_iter(proc->files, search_for_sym, &find);
+    int i;
+
+    for (i = 0; i < proc->nobjects && !sym; i++) {
+      sym = object_sym_lookup(proc->objects[i], name);
+    }
+    if (sym) {
+      /* callers may render the name */
+      gimli_symbol_name(sym);
+    }
     if (debug) {
-      printf("sym_lookup: %s => " PTRFMT "\n", name, find.sym ? find.sym->addr : 0);
+      printf("sym_lookup: %s => " PTRFMT "\n", name, sym ? sym->addr : 0);
     }
-    return find.sym;
+    return sym;
   }
 
-  f = gimli_find_object(proc, obj);
+  f = gimli_find_object_by_alias(proc, obj);
   if (!f) {
-    /* we may have just been given the basename of the object, in which
-     * case, we need to run through the list and match on basenames */
-    find.file = NULL;
-    find.name = obj;
-    gimli_hash_iter(proc->files, search_for_basename, &find);
-    if (!find.file) {
-      /* so maybe we were given the basename it refers to a symlink
-       * that we need to resolve... */
-      gimli_hash_iter(proc->files, search_for_symlink, &find);
-    }
-
-    if (!find.file) {
-      return NULL;
-    }
-    /* save the mapping */
-    gimli_hash_insert(proc->files, obj, find.file);
-    gimli_mapped_object_addref(find.file);
-    f = find.file;
+    return NULL;
   }
 
-  sym = sym_lookup(f, name);
+  sym = object_sym_lookup(f, name);
+  if (sym) {
+    gimli_symbol_name(sym);
+  }
   if (debug) {
     printf("sym_lookup: %s`%s => " PTRFMT "\n", obj, name, sym ? sym->addr : 0);
   }
@@ -363,6 +402,5 @@ struct gimli_symbol *gimli_sym_lookup(gimli_proc_t proc, const char *obj, const
   return sym;
 }
 
-
 /* vim:ts=2:sw=2:et:
  */
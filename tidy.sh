@@ -3,5 +3,6 @@
 
 rm -rf aclocal.m4 autom4te.cache ltmain.sh libtool configure config.status \
   config.sub config.guess Makefile Makefile.in config.log gimli_config.h* \
-  *.o *.lo monitor wedgie stamp-h1 *.la depcomp missing install-sh
+  *.o *.lo monitor wedgie hash-test stamp-h1 *.la depcomp missing install-sh \
+  test-driver
 
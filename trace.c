@@ -41,12 +41,15 @@ gimli_stack_trace_t gimli_thread_stack_trace(gimli_thread_t thr, int max_frames)
   trace->refcnt = 1;
   trace->thr = thr;
   STAILQ_INIT(&trace->frames);
+  gimli_slab_init_size(&trace->frameslab, sizeof(*frame), "frames",
+      16384, 262144);
+  gimli_slab_init(&trace->varslab, sizeof(struct gimli_variable), "vars");
 
   memset(&cur, 0, sizeof(cur));
   cur.proc = thr->proc;
 
   if (!gimli_init_unwind(&cur, thr)) {
-    free(trace);
+    gimli_stack_trace_delete(trace);
     return NULL;
   }
 
@@ -74,8 +77,13 @@ gimli_stack_trace_t gimli_thread_stack_trace(gimli_thread_t thr, int max_frames)
       break;
     }
 
-    frame = calloc(1, sizeof(*frame));
+    frame = gimli_slab_alloc(&trace->frameslab);
+    if (!frame) {
+      break;
+    }
+    memset(frame, 0, sizeof(*frame));
 
+    frame->trace = trace;
     STAILQ_INIT(&frame->vars);
     cur.frameno = trace->num_frames++;
     cur.tid = thr->lwpid;
@@ -113,26 +121,11 @@ void gimli_stack_trace_addref(gimli_stack_trace_t trace)
 
 void gimli_stack_trace_delete(gimli_stack_trace_t trace)
 {
-  gimli_stack_frame_t frame;
-
   if (--trace->refcnt) return;
 
-  while (STAILQ_FIRST(&trace->frames)) {
-    gimli_var_t var;
-
-    frame = STAILQ_FIRST(&trace->frames);
-    STAILQ_REMOVE_HEAD(&trace->frames, frames);
-
-    while (STAILQ_FIRST(&frame->vars)) {
-      var = STAILQ_FIRST(&frame->vars);
-      STAILQ_REMOVE_HEAD(&frame->vars, vars);
-
-      // FIXME: release type?
-      free(var);
-    }
-    free(frame);
-  }
-
+  /* the frames and variables live in the trace's slabs */
+  gimli_slab_destroy(&trace->frameslab);
+  gimli_slab_destroy(&trace->varslab);
   free(trace);
 }
 
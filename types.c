@@ -37,6 +37,9 @@ struct gimli_type_collection {
   gimli_hash_t type_by_name;
   /* hash of name => function type */
   gimli_hash_t func_by_name;
+  /* hash of interning key => gimli_type_t, so that equivalent types
+   * share one gimli_type_t; see gimli_type_collection_intern() */
+  gimli_hash_t interned;
 
   /* list of all type objects allocated against us */
   STAILQ_HEAD(typelist, gimli_type) typelist;
@@ -47,8 +50,8 @@ struct gimli_type {
 
   int kind;
   const char *name;
-  char *declname;
-  char declbuf[24];
+  /* C declaration, rendered on first use; lives in the intern pool */
+  const char *declname;
   struct gimli_type_encoding enc;
   gimli_type_t target;
 
@@ -105,9 +108,15 @@ typedef struct decl_node {
   unsigned int n;
 } *decl_node_t;
 
+/* nodes are taken from storage inside the decl; only a declaration
+ * nested more deeply than this falls back to malloc */
+#define DECL_INLINE_NODES 32
+
 typedef struct decl {
   /* declaration node stacks */
   TAILQ_HEAD(nodes, decl_node) nodes[PREC_MAX];
+  /* nodes in use */
+  int nnodes;
   /* storage order of decls */
   int order[PREC_MAX];
   /* qualifier precision */
@@ -122,13 +131,15 @@ typedef struct decl {
   char *end;
   /* space required */
   size_t len;
+  /* node storage; kept last, as it needn't be cleared */
+  struct decl_node node_store[DECL_INLINE_NODES];
 } *decl_t;
 
 static void decl_init(decl_t cd, char *buf, size_t len)
 {
   int i;
 
-  memset(cd, 0, sizeof(*cd));
+  memset(cd, 0, offsetof(struct decl, node_store));
 
   for (i = PREC_BASE; i < PREC_MAX; i++) {
     cd->order[i] = PREC_BASE - 1;
@@ -146,9 +157,14 @@ static void decl_fini(decl_t cd)
   decl_node_t cdp, ndp;
   int i;
 
+  if (cd->nnodes <= DECL_INLINE_NODES) {
+    return;
+  }
   for (i = PREC_BASE; i < PREC_MAX; i++) {
     TAILQ_FOREACH_SAFE(cdp, &cd->nodes[i], list, ndp) {
-      free(cdp);
+      if (cdp < cd->node_store || cdp >= cd->node_store + DECL_INLINE_NODES) {
+        free(cdp);
+      }
     }
   }
 }
@@ -197,7 +213,12 @@ static void decl_push(decl_t cd, gimli_type_t type)
       prec = PREC_BASE;
   }
 
-  cdp = calloc(1, sizeof(*cdp));
+  if (cd->nnodes < DECL_INLINE_NODES) {
+    cdp = &cd->node_store[cd->nnodes];
+  } else {
+    cdp = malloc(sizeof(*cdp));
+  }
+  cd->nnodes++;
   cdp->type = type;
   cdp->n = n;
 
@@ -328,6 +349,7 @@ gimli_type_collection_t gimli_type_collection_new(void)
   STAILQ_INIT(&col->typelist);
   col->type_by_name = gimli_hash_new(NULL);
   col->func_by_name = gimli_hash_new(NULL);
+  col->interned = gimli_hash_new(NULL);
 
   return col;
 }
@@ -354,9 +376,6 @@ static void delete_type(gimli_type_t t)
 
   free(t->members);
 //  free(t->name);
-  if (t->declname != t->declbuf) {
-    free(t->declname);
-  }
   free(t);
 }
 
@@ -422,6 +441,7 @@ void gimli_type_collection_delete(gimli_type_collection_t col)
 
   gimli_hash_destroy(col->type_by_name);
   gimli_hash_destroy(col->func_by_name);
+  gimli_hash_destroy(col->interned);
 
   while (!STAILQ_EMPTY(&col->typelist)) {
     gimli_type_t t = STAILQ_FIRST(&col->typelist);
@@ -489,13 +509,9 @@ static gimli_iter_status_t find_type_in_object2(
   struct type_lookup_data *data = arg;
   gimli_mapped_object_t file = item;
 
-  gimli_dwarf_load_all_types(file);
-
-  if (file->types) {
-    data->result = gimli_type_collection_find_type(file->types, data->typename);
-    if (data->result) {
-      return GIMLI_ITER_STOP;
-    }
+  data->result = gimli_dwarf_load_type_by_name(file, data->typename);
+  if (data->result) {
+    return GIMLI_ITER_STOP;
   }
 
   return GIMLI_ITER_CONT;
@@ -529,6 +545,41 @@ gimli_type_t gimli_find_type_by_addr(gimli_proc_t proc,
   return gimli_dwarf_load_type_for_data(proc, addr);
 }
 
+/* Types that are completely described at creation (integers, floats,
+ * pointers, qualifiers, typedefs and arrays) are interned by their
+ * structure, so that a type referenced from many places, or described
+ * again in each CU, has a single instance.  Aggregates are filled in
+ * after creation, so their producer supplies the key instead */
+static void intern_key(char *key, size_t len, int kind, const char *name,
+    const struct gimli_type_encoding *enc, gimli_type_t target,
+    uint32_t nelems)
+{
+  /* the name is keyed by its interned address, so that a long name
+   * can't be truncated into the key of a different type */
+  snprintf(key, len, "@%d:%p:%" PRIu32 ":%" PRIu32 ":%" PRIu32 ":%" PRIu32 ":%p",
+      kind, (void*)target,
+      enc ? enc->format : 0, enc ? enc->offset : 0, enc ? enc->bits : 0,
+      nelems, (void*)gimli_intern(name));
+}
+
+gimli_type_t gimli_type_collection_find_interned(
+    gimli_type_collection_t col,
+    const char *key)
+{
+  gimli_type_t t;
+
+  if (gimli_hash_find(col->interned, key, (void**)&t)) {
+    return t;
+  }
+  return NULL;
+}
+
+void gimli_type_collection_intern(gimli_type_collection_t col,
+    const char *key, gimli_type_t t)
+{
+  gimli_hash_insert(col->interned, key, t);
+}
+
 gimli_type_t gimli_type_collection_find_function(
     gimli_type_collection_t col,
     const char *name)
@@ -550,14 +601,21 @@ const char *gimli_type_name(gimli_type_t t)
 const char *gimli_type_declname(gimli_type_t t)
 {
   ssize_t size;
+  char buf[256], *name;
 
   if (t->declname) return t->declname;
-  size = decl_lname(t, t->declbuf, sizeof(t->declbuf));
-  if (size > sizeof(t->declbuf) - 1) {
-    t->declname = malloc(size + 1);
-    decl_lname(t, t->declname, size + 1);
+
+  /* the same declarations recur across objects and type collections,
+   * so they are shared through the intern pool.  Most fit in buf and
+   * are rendered just once */
+  size = decl_lname(t, buf, sizeof(buf));
+  if (size > sizeof(buf) - 1) {
+    name = malloc(size + 1);
+    decl_lname(t, name, size + 1);
+    t->declname = gimli_intern(name);
+    free(name);
   } else {
-    t->declname = t->declbuf;
+    t->declname = gimli_intern(buf);
   }
 
   return t->declname;
@@ -654,12 +712,23 @@ static gimli_type_t new_type(gimli_type_collection_t col,
 gimli_type_t gimli_type_new_array(gimli_type_collection_t col,
     const struct gimli_type_arinfo *info)
 {
-  gimli_type_t t = new_type(col, GIMLI_K_ARRAY, NULL, NULL);
+  char key[128];
+  gimli_type_t t;
+
+  intern_key(key, sizeof(key), GIMLI_K_ARRAY, NULL, NULL,
+      info->contents, info->nelems);
+  t = gimli_type_collection_find_interned(col, key);
+  if (t) {
+    return t;
+  }
+
+  t = new_type(col, GIMLI_K_ARRAY, NULL, NULL);
 
   memcpy(&t->arinfo, info, sizeof(*info));
 
   t->enc.bits = t->arinfo.nelems * gimli_type_size(t->arinfo.contents);
 
+  gimli_type_collection_intern(col, key, t);
   return t;
 }
 
@@ -671,16 +740,37 @@ int gimli_type_arinfo(gimli_type_t t,
   return 1;
 }
 
+static gimli_type_t new_interned_type(gimli_type_collection_t col,
+    int kind, const char *name,
+    const struct gimli_type_encoding *enc, gimli_type_t target)
+{
+  char key[128];
+  gimli_type_t t;
+
+  intern_key(key, sizeof(key), kind, name, enc, target, 0);
+  t = gimli_type_collection_find_interned(col, key);
+  if (t) {
+    return t;
+  }
+
+  t = new_type(col, kind, name, enc);
+  if (!t) return NULL;
+  t->target = target;
+
+  gimli_type_collection_intern(col, key, t);
+  return t;
+}
+
 gimli_type_t gimli_type_new_integer(gimli_type_collection_t col,
     const char *name, const struct gimli_type_encoding *enc)
 {
-  return new_type(col, GIMLI_K_INTEGER, name, enc);
+  return new_interned_type(col, GIMLI_K_INTEGER, name, enc, NULL);
 }
 
 gimli_type_t gimli_type_new_float(gimli_type_collection_t col,
     const char *name, const struct gimli_type_encoding *enc)
 {
-  return new_type(col, GIMLI_K_FLOAT, name, enc);
+  return new_interned_type(col, GIMLI_K_FLOAT, name, enc, NULL);
 }
 
 gimli_type_t gimli_type_resolve(gimli_type_t t)
@@ -714,18 +804,12 @@ static gimli_type_t new_alias(gimli_type_collection_t col,
     int kind, gimli_type_t target)
 {
   struct gimli_type_encoding enc;
-  gimli_type_t t;
 
   memset(&enc, 0, sizeof(enc));
   if (kind == GIMLI_K_POINTER) {
     enc.bits = 8 * sizeof(void*);
   }
-  t = new_type(col, kind, NULL, &enc);
-
-  if (!t) return NULL;
-  t->target = target;
-
-  return t;
+  return new_interned_type(col, kind, NULL, &enc, target);
 }
 
 gimli_type_t gimli_type_new_struct(gimli_type_collection_t col, const char *name)
@@ -741,9 +825,7 @@ gimli_type_t gimli_type_new_union(gimli_type_collection_t col, const char *name)
 gimli_type_t gimli_type_new_typedef(gimli_type_collection_t col,
     gimli_type_t target, const char *name)
 {
-  gimli_type_t t = new_type(col, GIMLI_K_TYPEDEF, name, NULL);
-  if (t) t->target = target;
-  return t;
+  return new_interned_type(col, GIMLI_K_TYPEDEF, name, NULL, target);
 }
 
 gimli_type_t gimli_type_new_volatile(gimli_type_collection_t col,
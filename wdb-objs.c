@@ -524,6 +524,12 @@ static void make_var(lua_State *L, struct wdb_vars *vars,
           v->location = 0;
         }
         break;
+      case DW_FORM_sec_offset:
+        if (!dw_calc_loclist(&v->cur, v->comp_unit_base, v->m,
+              location, &v->location, &v->is_stack)) {
+          v->location = 0;
+        }
+        break;
       default:
         printf("Unhandled location form %llx\n", location->form);
     }
@@ -632,6 +638,10 @@ static void make_vars(lua_State *L, struct wdb_frame *f)
               frame_base_attr->code, &vars->frame_base, NULL,
               &tmp);
           break;
+        case DW_FORM_sec_offset:
+          dw_calc_loclist(&vars->cur, vars->comp_unit_base, vars->m,
+              frame_base_attr, &vars->frame_base, &tmp);
+          break;
         default:
           printf("Unhandled frame base form %llx\n",
               frame_base_attr->form);